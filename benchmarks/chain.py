@@ -5,11 +5,14 @@ other, where each coroutine will increment the value before passing it
 along.
 """
 
+import collections
 import os
 import pyperf
 import greenlet
 
-# This is obsolete now, we always expose frames for Python 3.12.
+# On Python 3.12+, greenlets only expose their frames when they switch
+# away if ``gr_frames_always_exposed`` is set (or something else can
+# reach them); otherwise it's done when ``gr_frame`` is read.
 # See https://github.com/python-greenlet/greenlet/pull/393/
 # for a complete discussion of performance.
 EXPOSE_FRAMES = 'EXPOSE_FRAMES' in os.environ
@@ -95,6 +98,34 @@ def bm_switch_shallow(loops):
     end = pyperf.perf_counter()
     return end - begin
 
+def bm_switch_single_value(loops):
+    # Switching one value back and forth. Before switch() had a
+    # single-value fast path, every switch allocated a 1-tuple to
+    # carry the value. A tuple is used as the value because those
+    # still needed a 1-tuple after non-tuple values stopped needing one.
+    message = ('message', 1)
+
+    def run(value):
+        switch = main.switch
+        for _ in range(SWITCH_INNER_LOOPS):
+            value = switch(value)
+        return value
+
+    begin = pyperf.perf_counter()
+
+    for _ in range(loops):
+        main = greenlet.getcurrent()
+        gl = greenlet.greenlet(run)
+        gl.gr_frames_always_exposed = EXPOSE_FRAMES
+        value = gl.switch(message)
+        while not gl.dead:
+            assert value is message
+            value = gl.switch(value)
+        assert value is message
+
+    end = pyperf.perf_counter()
+    return end - begin
+
 def bm_switch_deep(loops, _MAX_DEPTH=200):
     # pylint:disable=attribute-defined-outside-init
     class G(greenlet.greenlet):
@@ -151,7 +182,107 @@ def bm_create(loops):
     end = pyperf.perf_counter()
     return end - begin
 
+def _run_nothing():
+    pass
+
+def _bm_create_and_run(loops, **kwargs):
+    gl = greenlet.greenlet
+    begin = pyperf.perf_counter()
+    for _ in range(loops):
+        gl(_run_nothing, **kwargs).switch()
+        gl(_run_nothing, **kwargs).switch()
+        gl(_run_nothing, **kwargs).switch()
+        gl(_run_nothing, **kwargs).switch()
+        gl(_run_nothing, **kwargs).switch()
+        gl(_run_nothing, **kwargs).switch()
+        gl(_run_nothing, **kwargs).switch()
+        gl(_run_nothing, **kwargs).switch()
+        gl(_run_nothing, **kwargs).switch()
+        gl(_run_nothing, **kwargs).switch()
+    end = pyperf.perf_counter()
+    return end - begin
+
+def bm_create_and_run(loops):
+    return _bm_create_and_run(loops)
+
+def bm_create_and_run_dedicated_stack(loops):
+    return _bm_create_and_run(loops, stack_size=256 * 1024)
+
+
+RUN_QUEUE_GREENLETS = 100
+RUN_QUEUE_HOPS = 100
+
+def _run_queue_worker(schedule, hub_switch):
+    me = greenlet.getcurrent()
+    for _ in range(RUN_QUEUE_HOPS):
+        schedule(me, None)
+        hub_switch()
+
+def bm_run_queue_python(loops):
+    # The ready queue as Python frameworks do it: a deque, and a loop
+    # that pops and switches.
+    begin = pyperf.perf_counter()
+    for _ in range(loops):
+        ready = collections.deque()
+        hub = greenlet.getcurrent()
+        def schedule(g, *args):
+            ready.append((g, args))
+        for _ in range(RUN_QUEUE_GREENLETS):
+            schedule(greenlet.greenlet(_run_queue_worker), schedule, hub.switch)
+        popleft = ready.popleft
+        while ready:
+            g, args = popleft()
+            g.switch(*args)
+    end = pyperf.perf_counter()
+    return end - begin
+
+def bm_run_queue_native(loops):
+    begin = pyperf.perf_counter()
+    for _ in range(loops):
+        queue = greenlet.RunQueue()
+        hub = greenlet.getcurrent()
+        for _ in range(RUN_QUEUE_GREENLETS):
+            queue.spawn(_run_queue_worker, queue.schedule, hub.switch)
+        queue.run_until_empty()
+    end = pyperf.perf_counter()
+    return end - begin
+
 
+MESSAGES = 10000
+
+def bm_messages_switch(loops):
+    # Handing objects to a consumer with switch(); each one is packed
+    # into an argument tuple and unpacked again.
+    begin = pyperf.perf_counter()
+    for _ in range(loops):
+        main_switch = greenlet.getcurrent().switch
+        def consume():
+            while main_switch() is not None:
+                pass
+        consumer = greenlet.greenlet(consume)
+        consumer.switch()
+        send = consumer.switch
+        for i in range(MESSAGES):
+            send(i)
+        send(None)
+    end = pyperf.perf_counter()
+    return end - begin
+
+def bm_messages_channel(loops):
+    begin = pyperf.perf_counter()
+    for _ in range(loops):
+        chan = greenlet.Channel()
+        def consume():
+            receive = chan.receive
+            while receive() is not None:
+                pass
+        greenlet.greenlet(consume).switch()
+        send = chan.send
+        for i in range(MESSAGES):
+            send(i)
+        send(None)
+    end = pyperf.perf_counter()
+    return end - begin
 
 
 def _bm_recur_frame(loops, RECUR_DEPTH):
@@ -209,12 +340,31 @@ if __name__ == '__main__':
         inner_loops=CREATE_INNER_LOOPS
     )
 
+    runner.bench_time_func(
+        'create and run a greenlet',
+        bm_create_and_run,
+        inner_loops=CREATE_INNER_LOOPS
+    )
+
+    if greenlet.GREENLET_USE_DEDICATED_STACKS:
+        runner.bench_time_func(
+            'create and run a greenlet with its own stack',
+            bm_create_and_run_dedicated_stack,
+            inner_loops=CREATE_INNER_LOOPS
+        )
+
     runner.bench_time_func(
         'switch between two greenlets (shallow)',
         bm_switch_shallow,
         inner_loops=SWITCH_INNER_LOOPS
     )
 
+    runner.bench_time_func(
+        'switch a single value between two greenlets',
+        bm_switch_single_value,
+        inner_loops=SWITCH_INNER_LOOPS
+    )
+
     runner.bench_time_func(
         'switch between two greenlets (deep)',
         bm_switch_deep,
@@ -226,6 +376,26 @@ if __name__ == '__main__':
         bm_switch_deeper,
         inner_loops=SWITCH_INNER_LOOPS
     )
+    runner.bench_time_func(
+        'run queue in Python',
+        bm_run_queue_python,
+        inner_loops=RUN_QUEUE_GREENLETS * (RUN_QUEUE_HOPS + 1)
+    )
+    runner.bench_time_func(
+        'greenlet.RunQueue',
+        bm_run_queue_native,
+        inner_loops=RUN_QUEUE_GREENLETS * (RUN_QUEUE_HOPS + 1)
+    )
+    runner.bench_time_func(
+        'messages with switch()',
+        bm_messages_switch,
+        inner_loops=MESSAGES
+    )
+    runner.bench_time_func(
+        'messages with greenlet.Channel',
+        bm_messages_channel,
+        inner_loops=MESSAGES
+    )
     runner.bench_time_func(
         'getcurrent single thread',
         bm_getcurrent,
@@ -166,6 +166,11 @@ else:
             ] + ([
                 ('WIN32', '1'),
             ] if is_win else [
+            ]) + ([
+                # Static probe points for SystemTap, bpftrace, etc.
+                # Needs <sys/sdt.h>. See greenlet_usdt.hpp.
+                ('GREENLET_USDT', '1'),
+            ] if os.environ.get('GREENLET_USDT') in ('1', 'yes') else [
             ])
         ),
         # Test extensions.
@@ -150,6 +150,47 @@ Extern_PyGreenlet_GET_PARENT(PyGreenlet* self)
     // This can return NULL even if there is no exception
     return self->pimpl->parent().acquire();
 }
+
+static int
+PyGreenlet_SetTraceHook(PyGreenlet_TraceHook hook, void* arg)
+{
+    if (greenlet::IsShuttingDown()) {
+        PyErr_SetString(PyExc_RuntimeError, "greenlet is being finalized");
+        return -1;
+    }
+    GET_THREAD_STATE().state().set_trace_hook(hook, arg);
+    return 0;
+}
+
+static PyGreenlet_TraceHook
+PyGreenlet_GetTraceHook(void** arg)
+{
+    PyGreenlet_TraceHook hook = nullptr;
+    void* hook_arg = nullptr;
+    if (!greenlet::IsShuttingDown()) {
+        const ThreadState& state = GET_THREAD_STATE().state();
+        hook = state.trace_hook();
+        hook_arg = state.trace_hook_arg();
+    }
+    if (arg) {
+        *arg = hook_arg;
+    }
+    return hook;
+}
+
+static int
+PyGreenlet_DumpSwitchHistory(int fd)
+{
+    // This may be called from a signal handler, without the GIL.
+    // Touching the thread state's thread-local for the first time
+    // registers its destructor, which may allocate, so don't.
+    const greenlet::SwitchHistory* const history = greenlet::g_thread_switch_history;
+    if (!history) {
+        return -1;
+    }
+    history->dump(fd);
+    return 0;
+}
 } // extern C.
 
 /** End C API ****************************************************************/
@@ -0,0 +1,567 @@
+/* -*- indent-tabs-mode: nil; tab-width: 4; -*- */
+#ifndef PY_CHANNEL_CPP
+#define PY_CHANNEL_CPP
+/**
+   Implementation of the Python slots for PyChannel_Type.
+
+   A channel passes objects from one greenlet to another. When a
+   greenlet is already waiting on the other end, the object is handed
+   straight to it in the switch: it becomes the value the waiting
+   ``receive()`` returns, without being packed into an argument tuple
+   and unpacked again as ``switch()`` has to do.
+*/
+
+#include <deque>
+#include <algorithm>
+#include <new>
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "greenlet_internal.hpp"
+#include "greenlet_refs.hpp"
+#include "greenlet_allocator.hpp"
+#include "TGreenlet.hpp"
+#include "TThreadState.hpp"
+#include "PyGreenlet.hpp"
+
+using greenlet::PyErrOccurred;
+using greenlet::ThreadState;
+using greenlet::SwitchingArgs;
+
+namespace greenlet {
+    /**
+     * A greenlet blocked in ``send()``, and what it's sending. The
+     * channel owns the references.
+     */
+    struct ChannelSender
+    {
+        PyGreenlet* glet;
+        PyObject* value;
+    };
+
+    typedef std::deque<PyObject*, PythonAllocator<PyObject*> > channel_objects_t;
+    typedef std::deque<PyGreenlet*, PythonAllocator<PyGreenlet*> > channel_greenlets_t;
+    typedef std::deque<ChannelSender, PythonAllocator<ChannelSender> > channel_senders_t;
+};
+
+using greenlet::ChannelSender;
+using greenlet::channel_objects_t;
+using greenlet::channel_greenlets_t;
+using greenlet::channel_senders_t;
+
+typedef struct {
+    PyObject_HEAD
+    // The main greenlet of the thread the channel belongs to. Only
+    // that thread can use it.
+    PyGreenlet* main_greenlet;
+    // Negative for no limit.
+    Py_ssize_t maxsize;
+    // If given, greenlets whose operation finished without them being
+    // switched to are scheduled here, as well as going on ``ready``
+    // to show the switch is still wanted. Otherwise they only go on
+    // ``ready``.
+    PyRunQueue* queue;
+    channel_objects_t* buffer;
+    channel_greenlets_t* receivers;
+    channel_senders_t* senders;
+    channel_greenlets_t* ready;
+} PyChannel;
+
+
+static PyObject*
+channel_new(PyTypeObject* type, PyObject* args, PyObject* kwargs)
+{
+    static const char* const kwlist[] = {"maxsize", "queue", nullptr};
+    PyObject* maxsize = nullptr;
+    PyObject* queue = nullptr;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OO:Channel",
+                                     const_cast<char**>(kwlist),
+                                     &maxsize, &queue)) {
+        return nullptr;
+    }
+    Py_ssize_t limit = 0;
+    if (maxsize == Py_None) {
+        limit = -1;
+    }
+    else if (maxsize) {
+        limit = PyNumber_AsSsize_t(maxsize, PyExc_OverflowError);
+        if (limit == -1 && PyErr_Occurred()) {
+            return nullptr;
+        }
+        if (limit < 0) {
+            PyErr_SetString(PyExc_ValueError, "maxsize must be None or >= 0");
+            return nullptr;
+        }
+    }
+    if (queue == Py_None) {
+        queue = nullptr;
+    }
+    if (queue && !PyObject_TypeCheck(queue, &PyRunQueue_Type)) {
+        PyErr_SetString(PyExc_TypeError, "queue must be a RunQueue or None");
+        return nullptr;
+    }
+
+    PyChannel* self = reinterpret_cast<PyChannel*>(type->tp_alloc(type, 0));
+    if (!self) {
+        return nullptr;
+    }
+    self->main_greenlet = GET_THREAD_STATE().state().borrow_main_greenlet().borrow();
+    Py_INCREF(self->main_greenlet);
+    self->maxsize = limit;
+    self->queue = reinterpret_cast<PyRunQueue*>(queue);
+    Py_XINCREF(self->queue);
+    self->buffer = new (std::nothrow) channel_objects_t;
+    self->receivers = new (std::nothrow) channel_greenlets_t;
+    self->senders = new (std::nothrow) channel_senders_t;
+    self->ready = new (std::nothrow) channel_greenlets_t;
+    if (!self->buffer || !self->receivers || !self->senders || !self->ready) {
+        // The other slots expect all of them or none.
+        delete self->buffer;
+        delete self->receivers;
+        delete self->senders;
+        delete self->ready;
+        self->buffer = nullptr;
+        self->receivers = nullptr;
+        self->senders = nullptr;
+        self->ready = nullptr;
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    return reinterpret_cast<PyObject*>(self);
+}
+
+static int
+channel_traverse(PyChannel* self, visitproc visit, void* arg)
+{
+    Py_VISIT(self->main_greenlet);
+    Py_VISIT(self->queue);
+    if (self->buffer) {
+        for (PyObject* value : *self->buffer) {
+            Py_VISIT(value);
+        }
+        for (PyGreenlet* glet : *self->receivers) {
+            Py_VISIT(glet);
+        }
+        for (const ChannelSender& sender : *self->senders) {
+            Py_VISIT(sender.glet);
+            Py_VISIT(sender.value);
+        }
+        for (PyGreenlet* glet : *self->ready) {
+            Py_VISIT(glet);
+        }
+    }
+    return 0;
+}
+
+static int
+channel_clear(PyChannel* self)
+{
+    // Decref'ing can run arbitrary code, which might use the
+    // channel, so take everything out first.
+    channel_objects_t buffer;
+    channel_greenlets_t receivers;
+    channel_senders_t senders;
+    channel_greenlets_t ready;
+    if (self->buffer) {
+        buffer.swap(*self->buffer);
+        receivers.swap(*self->receivers);
+        senders.swap(*self->senders);
+        ready.swap(*self->ready);
+    }
+    Py_CLEAR(self->queue);
+    for (PyObject*& value : buffer) {
+        Py_CLEAR(value);
+    }
+    for (PyGreenlet*& glet : receivers) {
+        Py_CLEAR(glet);
+    }
+    for (ChannelSender& sender : senders) {
+        Py_CLEAR(sender.glet);
+        Py_CLEAR(sender.value);
+    }
+    for (PyGreenlet*& glet : ready) {
+        Py_CLEAR(glet);
+    }
+    return 0;
+}
+
+static void
+channel_dealloc(PyChannel* self)
+{
+    PyObject_GC_UnTrack(self);
+    channel_clear(self);
+    delete self->buffer;
+    delete self->receivers;
+    delete self->senders;
+    delete self->ready;
+    self->buffer = nullptr;
+    self->receivers = nullptr;
+    self->senders = nullptr;
+    self->ready = nullptr;
+    Py_CLEAR(self->main_greenlet);
+    Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+/**
+ * Return the state of the running thread, or set an exception and
+ * return null if the channel doesn't belong to it.
+ */
+static ThreadState*
+channel_check_thread(PyChannel* self)
+{
+    ThreadState& state = GET_THREAD_STATE().state();
+    if (state.borrow_main_greenlet().borrow() != self->main_greenlet) {
+        PyErr_SetString(mod_globs->PyExc_GreenletError,
+                        "cannot use a Channel from a different thread");
+        return nullptr;
+    }
+    return &state;
+}
+
+/**
+ * If *glet* is in *waiting*, remove it (and the reference) and
+ * return true.
+ */
+static bool
+channel_forget(channel_greenlets_t& waiting, PyGreenlet* glet)
+{
+    const channel_greenlets_t::iterator it = std::find(waiting.begin(), waiting.end(), glet);
+    if (it == waiting.end()) {
+        return false;
+    }
+    waiting.erase(it);
+    Py_DECREF(glet);
+    return true;
+}
+
+static bool
+channel_forget(channel_senders_t& waiting, PyGreenlet* glet)
+{
+    for (channel_senders_t::iterator it = waiting.begin(); it != waiting.end(); ++it) {
+        if (it->glet == glet) {
+            const ChannelSender sender = *it;
+            waiting.erase(it);
+            Py_DECREF(sender.glet);
+            Py_DECREF(sender.value);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * The run queue is about to switch to *glet* for the channel
+ * *waker*. That's only still wanted if *glet* hasn't been resumed
+ * some other way, taking itself off ``ready``.
+ */
+static bool
+channel_claim_wake(PyObject* waker, PyGreenlet* glet)
+{
+    PyChannel* const self = reinterpret_cast<PyChannel*>(waker);
+    return self->ready && channel_forget(*self->ready, glet);
+}
+
+/**
+ * *glet*, which is blocked in ``send()``, has had its object taken,
+ * so arrange for something to switch back to it. Steals the
+ * reference.
+ */
+static void
+channel_wake(PyChannel* self, PyGreenlet* glet)
+{
+    self->ready->push_back(glet);
+    if (self->queue) {
+        // Can't fail except for lack of memory, in which case the
+        // sender stays blocked and the error is reported here.
+        PyObject* const args = mod_globs->empty_tuple.borrow();
+        Py_INCREF(args);
+        if (!runqueue_push(self->queue, glet, args, nullptr,
+                           reinterpret_cast<PyObject*>(self), channel_claim_wake)) {
+            PyErr_WriteUnraisable(reinterpret_cast<PyObject*>(self));
+            channel_forget(*self->ready, glet);
+        }
+    }
+}
+
+/**
+ * Switch to *target*, handing it *value*.
+ *
+ * This is a switch with a single value, so the pending switch in the
+ * target returns *value* itself; nothing gets wrapped or unwrapped on
+ * the way.
+ */
+static OwnedObject
+channel_switch_to(ThreadState& state, PyGreenlet* target, PyObject* value)
+{
+#ifdef Py_GIL_DISABLED
+    target->pimpl->check_switch_allowed(state);
+#endif
+    SwitchingArgs switch_args(OwnedObject::owning(value));
+    target->pimpl->may_switch_away();
+    target->pimpl->args() <<= switch_args;
+    return target->pimpl->g_switch(state);
+}
+
+/**
+ * The current greenlet has put itself in one of the waiting lists;
+ * switch away until something switches back. That's a greenlet on
+ * ``ready``, if there is one, and otherwise the parent.
+ */
+static OwnedObject
+channel_block(PyChannel* self, ThreadState& state, const BorrowedGreenlet& current)
+{
+    if (!self->queue && !self->ready->empty()) {
+        const OwnedGreenlet next = OwnedGreenlet::consuming(self->ready->front());
+        self->ready->pop_front();
+        return channel_switch_to(state, next.borrow(), mod_globs->empty_tuple.borrow());
+    }
+    const OwnedGreenlet parent = current->parent();
+    if (!parent) {
+        throw PyErrOccurred(mod_globs->PyExc_GreenletError,
+                            "channel operation would block with nothing to switch to");
+    }
+    return channel_switch_to(state, parent.borrow(), mod_globs->empty_tuple.borrow());
+}
+
+PyDoc_STRVAR(channel_send_doc,
+             "send(value)\n"
+             "\n"
+             "Give *value* to a greenlet waiting in :meth:`receive`, switching\n"
+             "to it immediately; the current greenlet resumes later, when some\n"
+             "greenlet blocks on this channel (or, if the channel has a queue,\n"
+             "when the queue runs it). If nothing is waiting, buffer *value*\n"
+             "if there's room, or else block until a receiver takes it.\n");
+
+static PyObject*
+channel_send(PyChannel* self, PyObject* value)
+{
+    ThreadState* const state = channel_check_thread(self);
+    if (!state) {
+        return nullptr;
+    }
+    try {
+        const BorrowedGreenlet current = state->borrow_current();
+        // Keep the channel alive while we're switched away.
+        const OwnedObject holder = OwnedObject::owning(reinterpret_cast<PyObject*>(self));
+
+        if (!self->receivers->empty()) {
+            // With a receiver waiting, the buffer is empty.
+            assert(self->buffer->empty());
+            const OwnedGreenlet receiver = OwnedGreenlet::consuming(self->receivers->front());
+            self->receivers->pop_front();
+            Py_INCREF(current.borrow());
+            channel_wake(self, current.borrow());
+            try {
+                channel_switch_to(*state, receiver.borrow(), value);
+            }
+            catch (const PyErrOccurred&) {
+                channel_forget(*self->ready, current.borrow());
+                throw;
+            }
+            // If we were resumed by something other than the channel,
+            // don't let the channel (or its queue) switch to us
+            // again later.
+            channel_forget(*self->ready, current.borrow());
+            Py_RETURN_NONE;
+        }
+
+        if (self->maxsize < 0 || static_cast<Py_ssize_t>(self->buffer->size()) < self->maxsize) {
+            Py_INCREF(value);
+            self->buffer->push_back(value);
+            Py_RETURN_NONE;
+        }
+
+        Py_INCREF(current.borrow());
+        Py_INCREF(value);
+        self->senders->push_back(ChannelSender{current.borrow(), value});
+        try {
+            channel_block(self, *state, current);
+        }
+        catch (const PyErrOccurred&) {
+            channel_forget(*self->senders, current.borrow());
+            throw;
+        }
+        // Still listed means something other than a receiver
+        // switched to us; the value wasn't sent, but we don't
+        // wait any longer.
+        channel_forget(*self->senders, current.borrow());
+        channel_forget(*self->ready, current.borrow());
+        Py_RETURN_NONE;
+    }
+    catch (const PyErrOccurred&) {
+        return nullptr;
+    }
+    catch (const std::bad_alloc&) {
+        PyErr_NoMemory();
+        return nullptr;
+    }
+}
+
+PyDoc_STRVAR(channel_receive_doc,
+             "receive() -> object\n"
+             "\n"
+             "Return the next object sent on the channel, blocking the current\n"
+             "greenlet until there is one. A sender blocked in :meth:`send` is\n"
+             "woken, but not switched to.\n"
+             "\n"
+             "Blocking switches to a greenlet that a previous operation on the\n"
+             "channel woke, if there is one, and otherwise to the parent of the\n"
+             "current greenlet. If something other than a sender switches to the\n"
+             "blocked greenlet, this returns what it was switched with, as\n"
+             "``switch()`` would, and the greenlet is no longer waiting; if an\n"
+             "exception is thrown into it, the exception propagates.\n");
+
+static PyObject*
+channel_receive(PyChannel* self, PyObject* UNUSED(args))
+{
+    ThreadState* const state = channel_check_thread(self);
+    if (!state) {
+        return nullptr;
+    }
+    try {
+        if (!self->buffer->empty()) {
+            PyObject* const result = self->buffer->front();
+            self->buffer->pop_front();
+            if (!self->senders->empty()) {
+                // There's room now.
+                const ChannelSender sender = self->senders->front();
+                self->senders->pop_front();
+                self->buffer->push_back(sender.value);
+                channel_wake(self, sender.glet);
+            }
+            return result;
+        }
+
+        if (!self->senders->empty()) {
+            const ChannelSender sender = self->senders->front();
+            self->senders->pop_front();
+            channel_wake(self, sender.glet);
+            return sender.value;
+        }
+
+        const BorrowedGreenlet current = state->borrow_current();
+        const OwnedObject holder = OwnedObject::owning(reinterpret_cast<PyObject*>(self));
+        Py_INCREF(current.borrow());
+        self->receivers->push_back(current.borrow());
+        OwnedObject result;
+        try {
+            result = channel_block(self, *state, current);
+        }
+        catch (const PyErrOccurred&) {
+            channel_forget(*self->receivers, current.borrow());
+            throw;
+        }
+        // If we're still listed, this isn't from a sender; it's what
+        // a plain switch() would have returned.
+        channel_forget(*self->receivers, current.borrow());
+        return result.relinquish_ownership();
+    }
+    catch (const PyErrOccurred&) {
+        return nullptr;
+    }
+    catch (const std::bad_alloc&) {
+        PyErr_NoMemory();
+        return nullptr;
+    }
+}
+
+static PyObject*
+channel_get_balance(PyChannel* self, void* UNUSED(context))
+{
+    return PyLong_FromSsize_t(static_cast<Py_ssize_t>(self->senders->size())
+                              - static_cast<Py_ssize_t>(self->receivers->size()));
+}
+
+static PyObject*
+channel_get_maxsize(PyChannel* self, void* UNUSED(context))
+{
+    if (self->maxsize < 0) {
+        Py_RETURN_NONE;
+    }
+    return PyLong_FromSsize_t(self->maxsize);
+}
+
+static PyObject*
+channel_get_queue(PyChannel* self, void* UNUSED(context))
+{
+    PyObject* result = self->queue ? reinterpret_cast<PyObject*>(self->queue) : Py_None;
+    Py_INCREF(result);
+    return result;
+}
+
+static Py_ssize_t
+channel_len(PyChannel* self)
+{
+    return self->buffer->size();
+}
+
+static PyMethodDef channel_methods[] = {
+    {
+      .ml_name="send",
+      .ml_meth=(PyCFunction)channel_send,
+      .ml_flags=METH_O,
+      .ml_doc=channel_send_doc
+    },
+    {
+      .ml_name="receive",
+      .ml_meth=(PyCFunction)channel_receive,
+      .ml_flags=METH_NOARGS,
+      .ml_doc=channel_receive_doc
+    },
+    {.ml_name=NULL, .ml_meth=NULL} /* sentinel */
+};
+
+static PyGetSetDef channel_getsets[] = {
+    {
+      .name="balance",
+      .get=(getter)channel_get_balance,
+      .set=NULL,
+      .doc="The number of greenlets blocked sending, less the number blocked receiving."
+    },
+    {
+      .name="maxsize",
+      .get=(getter)channel_get_maxsize,
+      .set=NULL,
+      .doc="How many objects can be buffered; ``None`` for no limit."
+    },
+    {
+      .name="queue",
+      .get=(getter)channel_get_queue,
+      .set=NULL,
+      .doc="The RunQueue woken senders are scheduled on, or ``None``."
+    },
+    {.name=NULL} /* Sentinel */
+};
+
+static PySequenceMethods channel_as_sequence = {
+    .sq_length=(lenfunc)channel_len,
+};
+
+PyTypeObject PyChannel_Type = {
+    .ob_base=PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name="greenlet.Channel",
+    .tp_basicsize=sizeof(PyChannel),
+    .tp_dealloc=(destructor)channel_dealloc,
+    .tp_as_sequence=&channel_as_sequence,
+    .tp_flags=G_TPFLAGS_DEFAULT,
+    .tp_doc="Channel(maxsize=0, queue=None) -> Channel\n\n"
+    "Passes objects between greenlets of the current thread. With a\n"
+    "*maxsize* of 0, every send waits for a receiver; otherwise up to\n"
+    "*maxsize* objects (any number, if it's None) are buffered.\n"
+    "Senders woken without being switched to are scheduled on *queue*,\n"
+    "a RunQueue, if given; if a sender is resumed some other way first,\n"
+    "that switch is dropped.\n"
+    "\n"
+    "This is an implementation specific, provisional API. It may be changed or removed\n"
+    "in the future.\n",
+    .tp_traverse=(traverseproc)channel_traverse,
+    .tp_clear=(inquiry)channel_clear,
+    .tp_methods=channel_methods,
+    .tp_getset=channel_getsets,
+    .tp_alloc=PyType_GenericAlloc,
+    .tp_new=(newfunc)channel_new,
+    .tp_free=PyObject_GC_Del,
+};
+
+#endif
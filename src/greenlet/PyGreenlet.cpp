@@ -22,6 +22,7 @@ The Python slot functions for TGreenlet.
 #include "greenlet_slp_switch.hpp"
 
 #include "greenlet_thread_support.hpp"
+#include "greenlet_usdt.hpp"
 #include "TGreenlet.hpp"
 
 #include "TGreenletGlobals.cpp"
@@ -47,6 +48,7 @@ using greenlet::MainGreenlet;
 using greenlet::BrokenGreenlet;
 using greenlet::ThreadState;
 using greenlet::PythonState;
+using greenlet::GCDisabledGuard;
 using greenlet::refs::PyCriticalObjectSection;
 
 
@@ -80,15 +82,17 @@ green_init(PyGreenlet* self, PyObject* args, PyObject* kwargs)
 {
     PyArgParseParam run;
     PyArgParseParam nparent;
+    PyArgParseParam stack_size;
     static const char* kwlist[] = {
         "run",
         "parent",
+        "stack_size",
         NULL
     };
 
     // recall: The O specifier does NOT increase the reference count.
     if (!PyArg_ParseTupleAndKeywords(
-             args, kwargs, "|OO:green", (char**)kwlist, &run, &nparent)) {
+             args, kwargs, "|OO$O:green", (char**)kwlist, &run, &nparent, &stack_size)) {
         return -1;
     }
 
@@ -97,6 +101,23 @@ green_init(PyGreenlet* self, PyObject* args, PyObject* kwargs)
             return -1;
         }
     }
+    if (stack_size && !stack_size.is_None()) {
+        const Py_ssize_t nbytes = PyNumber_AsSsize_t(stack_size, PyExc_OverflowError);
+        if (nbytes == -1 && PyErr_Occurred()) {
+            return -1;
+        }
+        if (nbytes <= 0) {
+            PyErr_SetString(PyExc_ValueError, "stack_size must be positive");
+            return -1;
+        }
+        PyCriticalObjectSection cs(self);
+        try {
+            BorrowedGreenlet(self)->stack_size(nbytes);
+        }
+        catch (const PyErrOccurred&) {
+            return -1;
+        }
+    }
     if (nparent && !nparent.is_None()) {
         return green_setparent(self, nparent, NULL);
     }
@@ -344,7 +365,7 @@ internal_green_throw(BorrowedGreenlet self, PyErrPieces& err_pieces)
     }
     self->args() <<= result;
 
-    return single_result(self->g_switch());
+    return self->g_switch();
 }
 
 
@@ -369,8 +390,18 @@ PyDoc_STRVAR(
     "function will simply return the arguments using the same rules as\n"
     "above.\n");
 
+static PyObject*
+internal_green_switch(PyGreenlet* self, greenlet::SwitchingArgs& switch_args);
+
 static PyObject*
 green_switch(PyGreenlet* self, PyObject* args, PyObject* kwargs)
+{
+    greenlet::SwitchingArgs switch_args(OwnedObject::owning(args), OwnedObject::owning(kwargs));
+    return internal_green_switch(self, switch_args);
+}
+
+static PyObject*
+internal_green_switch(PyGreenlet* self, greenlet::SwitchingArgs& switch_args)
 {
     // Our use of Greenlet::args() makes this method non-reentrant.
     // Therefore, check to be sure the switch will be allowed ---
@@ -385,9 +416,12 @@ green_switch(PyGreenlet* self, PyObject* args, PyObject* kwargs)
     // function and the GIL to keep us from being reentered in regular
     // builds. BUT should we always do this as an extra measure of
     // safety in case we run code at unexpected times (e.g., a GC?)
+    //
+    // Either way, we look up the thread state just once, here.
+    ThreadState& current_thread_state = GET_THREAD_STATE().state();
 #ifdef Py_GIL_DISABLED
     try {
-        self->pimpl->check_switch_allowed();
+        self->pimpl->check_switch_allowed(current_thread_state);
     }
     catch (const PyErrOccurred&) {
         return nullptr;
@@ -395,8 +429,6 @@ green_switch(PyGreenlet* self, PyObject* args, PyObject* kwargs)
 #endif
 
 
-    using greenlet::SwitchingArgs;
-    SwitchingArgs switch_args(OwnedObject::owning(args), OwnedObject::owning(kwargs));
     self->pimpl->may_switch_away();
     self->pimpl->args() <<= switch_args;
 
@@ -420,7 +452,7 @@ green_switch(PyGreenlet* self, PyObject* args, PyObject* kwargs)
     // second byte of the CALL_METHOD op for ``getcurrent()``).
 
     try {
-        OwnedObject result(single_result(self->pimpl->g_switch()));
+        OwnedObject result(self->pimpl->g_switch(current_thread_state));
 #ifndef NDEBUG
         // Note that the current greenlet isn't necessarily self. If self
         // finished, we went to one of its parents.
@@ -455,6 +487,55 @@ green_switch(PyGreenlet* self, PyObject* args, PyObject* kwargs)
     }
 }
 
+/**
+ * The ``switch`` method, called with the vectorcall protocol.
+ *
+ * With no keyword arguments and one positional argument, that
+ * argument is switched as a single value: it's delivered as it is,
+ * rather than packed into a 1-tuple only for the other end to unpack
+ * it, so the common ``g.switch(value)`` allocates nothing.
+ */
+static PyObject*
+green_switch_fastcall(PyGreenlet* self,
+                      PyObject* const* args,
+                      Py_ssize_t nargs,
+                      PyObject* kwnames)
+{
+    if (!kwnames || !PyTuple_GET_SIZE(kwnames)) {
+        if (nargs == 0) {
+            return green_switch(self, mod_globs->empty_tuple, nullptr);
+        }
+        if (nargs == 1) {
+            greenlet::SwitchingArgs switch_args(OwnedObject::owning(args[0]));
+            return internal_green_switch(self, switch_args);
+        }
+    }
+
+    const OwnedObject switch_args = OwnedObject::consuming(PyTuple_New(nargs));
+    if (!switch_args) {
+        return nullptr;
+    }
+    for (Py_ssize_t i = 0; i < nargs; ++i) {
+        Py_INCREF(args[i]);
+        PyTuple_SET_ITEM(switch_args.borrow(), i, args[i]);
+    }
+    OwnedObject switch_kwargs;
+    if (kwnames && PyTuple_GET_SIZE(kwnames)) {
+        switch_kwargs = OwnedObject::consuming(PyDict_New());
+        if (!switch_kwargs) {
+            return nullptr;
+        }
+        for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(kwnames); ++i) {
+            if (PyDict_SetItem(switch_kwargs.borrow(),
+                               PyTuple_GET_ITEM(kwnames, i),
+                               args[nargs + i]) < 0) {
+                return nullptr;
+            }
+        }
+    }
+    return green_switch(self, switch_args.borrow(), switch_kwargs.borrow());
+}
+
 PyDoc_STRVAR(
     green_throw_doc,
     "Switches execution to this greenlet, but immediately raises the\n"
@@ -475,7 +556,7 @@ PyDoc_STRVAR(
     "from ``g_raiser`` to ``g``.\n");
 
 static PyObject*
-green_throw(PyGreenlet* self, PyObject* args)
+green_throw(PyGreenlet* self, PyObject* const* args, Py_ssize_t nargs)
 {
     // See green_switch for why we call this early.
 #ifdef Py_GIL_DISABLED
@@ -487,17 +568,19 @@ green_throw(PyGreenlet* self, PyObject* args)
     }
 #endif
 
-    PyArgParseParam typ(mod_globs->PyExc_GreenletExit);
-    PyArgParseParam val;
-    PyArgParseParam tb;
-
-    if (!PyArg_ParseTuple(args, "|OOO:throw", &typ, &val, &tb)) {
+    if (nargs > 3) {
+        PyErr_Format(PyExc_TypeError,
+                     "throw expected at most 3 arguments, got %zd", nargs);
         return nullptr;
     }
+    PyArgParseParam typ(nargs > 0 ? args[0] : mod_globs->PyExc_GreenletExit.borrow());
+    PyArgParseParam val(nargs > 1 ? args[1] : nullptr);
+    PyArgParseParam tb(nargs > 2 ? args[2] : nullptr);
 
     assert(typ.borrow() || val.borrow());
 
     self->pimpl->may_switch_away();
+    GREENLET_PROBE2(throw, self, typ.borrow());
     try {
         // Both normalizing the error and the actual throw_greenlet
         // could throw PyErrOccurred.
@@ -611,6 +694,16 @@ green_setrun(PyGreenlet* self, PyObject* nrun, void* UNUSED(context))
     }
 }
 
+static PyObject*
+green_getstack_size(PyGreenlet* self, void* UNUSED(context))
+{
+    const size_t nbytes = BorrowedGreenlet(self)->stack_size();
+    if (!nbytes) {
+        Py_RETURN_NONE;
+    }
+    return PyLong_FromSize_t(nbytes);
+}
+
 static PyObject*
 green_getparent(PyGreenlet* self, void* UNUSED(context))
 {
@@ -665,10 +758,72 @@ static PyObject*
 green_getframe(PyGreenlet* self, void* UNUSED(context))
 {
     PyCriticalObjectSection cs(self);
-    const PythonState::OwnedFrame& top_frame = BorrowedGreenlet(self)->top_frame();
+    const BorrowedGreenlet glet(self);
+#if GREENLET_PY312
+    {
+        // If it didn't expose its frames when it switched away
+        // (``gr_frames_always_exposed``), do it now. That may make
+        // frame objects, and a collection then could run code that
+        // switches into the greenlet halfway through.
+        GCDisabledGuard no_gc;
+        glet->expose_frames();
+    }
+#endif
+    const PythonState::OwnedFrame& top_frame = glet->top_frame();
     return top_frame.acquire_or_None();
 }
 
+static PyObject*
+green_get_frames_always_exposed(PyGreenlet* self, void* UNUSED(context))
+{
+    return PyBool_FromLong(BorrowedGreenlet(self)->frames_always_exposed());
+}
+
+static int
+green_set_frames_always_exposed(PyGreenlet* self, PyObject* value, void* UNUSED(context))
+{
+    if (!value) {
+        PyErr_SetString(PyExc_AttributeError, "can't delete gr_frames_always_exposed");
+        return -1;
+    }
+    const int exposed = PyObject_IsTrue(value);
+    if (exposed < 0) {
+        return -1;
+    }
+    BorrowedGreenlet(self)->frames_always_exposed(exposed);
+    return 0;
+}
+
+static PyObject*
+green_get_cpu_time(PyGreenlet* self, void* UNUSED(context))
+{
+    const BorrowedGreenlet glet(self);
+    int64_t run_ns = glet->run_ns();
+    // If it's running now, in whatever thread, count the time so
+    // far. (Not GET_THREAD_STATE(): that would create a state for
+    // this thread if it hasn't got one.)
+    const ThreadState* const state = glet->thread_state();
+    if (state && state->accounting_enabled() && state->is_current(glet)) {
+        run_ns += greenlet::SwitchStats::now_ns() - state->resumed_ns();
+    }
+    return PyFloat_FromDouble(run_ns / 1e9);
+}
+
+static PyObject*
+green_get_switch_count(PyGreenlet* self, void* UNUSED(context))
+{
+    return PyLong_FromUnsignedLongLong(BorrowedGreenlet(self)->resume_count());
+}
+
+static PyObject*
+green_get_last_resumed(PyGreenlet* self, void* UNUSED(context))
+{
+    const int64_t last_resumed_ns = BorrowedGreenlet(self)->last_resumed_ns();
+    if (!last_resumed_ns) {
+        Py_RETURN_NONE;
+    }
+    return PyFloat_FromDouble(last_resumed_ns / 1e9);
+}
 
 static PyObject*
 green_getstate(PyGreenlet* self)
@@ -748,11 +903,16 @@ green_repr(PyGreenlet* _self)
 static PyMethodDef green_methods[] = {
     {
       .ml_name="switch",
-      .ml_meth=reinterpret_cast<PyCFunction>(green_switch),
-      .ml_flags=METH_VARARGS | METH_KEYWORDS,
+      .ml_meth=reinterpret_cast<PyCFunction>(green_switch_fastcall),
+      .ml_flags=METH_FASTCALL | METH_KEYWORDS,
       .ml_doc=green_switch_doc
     },
-    {.ml_name="throw", .ml_meth=(PyCFunction)green_throw, .ml_flags=METH_VARARGS, .ml_doc=green_throw_doc},
+    {
+      .ml_name="throw",
+      .ml_meth=reinterpret_cast<PyCFunction>(green_throw),
+      .ml_flags=METH_FASTCALL,
+      .ml_doc=green_throw_doc
+    },
     {.ml_name="__getstate__", .ml_meth=(PyCFunction)green_getstate, .ml_flags=METH_NOARGS, .ml_doc=NULL},
     {.ml_name=NULL, .ml_meth=NULL} /* sentinel */
 };
@@ -762,13 +922,22 @@ static PyGetSetDef green_getsets[] = {
     {.name="__dict__", .get=(getter)green_getdict, .set=(setter)green_setdict},
     {.name="run", .get=(getter)green_getrun, .set=(setter)green_setrun},
     {.name="parent", .get=(getter)green_getparent, .set=(setter)green_setparent},
+    {.name="stack_size", .get=(getter)green_getstack_size},
     {.name="gr_frame", .get=(getter)green_getframe },
+    {
+      .name="gr_frames_always_exposed",
+      .get=(getter)green_get_frames_always_exposed,
+      .set=(setter)green_set_frames_always_exposed
+    },
     {
       .name="gr_context",
       .get=(getter)green_getcontext,
       .set=(setter)green_setcontext
     },
     {.name="dead", .get=(getter)green_getdead},
+    {.name="gr_cpu_time", .get=(getter)green_get_cpu_time},
+    {.name="gr_switch_count", .get=(getter)green_get_switch_count},
+    {.name="gr_last_resumed", .get=(getter)green_get_last_resumed},
     {.name="_stack_saved", .get=(getter)green_get_stack_saved},
     {.name=NULL}
 };
@@ -791,11 +960,14 @@ PyTypeObject PyGreenlet_Type = {
     .tp_repr=(reprfunc)green_repr,      /* tp_repr */
     .tp_as_number=&green_as_number,          /* tp_as _number*/
     .tp_flags=G_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /* tp_flags */
-    .tp_doc="greenlet(run=None, parent=None) -> greenlet\n\n"
+    .tp_doc="greenlet(run=None, parent=None, *, stack_size=None) -> greenlet\n\n"
     "Creates a new greenlet object (without running it).\n\n"
     " - *run* -- The callable to invoke.\n"
     " - *parent* -- The parent greenlet. The default is the current "
-    "greenlet.",                        /* tp_doc */
+    "greenlet.\n"
+    " - *stack_size* -- If given, the number of bytes of C stack to "
+    "give the greenlet for its own use, instead of sharing its "
+    "thread's stack.",                  /* tp_doc */
     .tp_traverse=(traverseproc)green_traverse, /* tp_traverse */
     .tp_clear=(inquiry)green_clear,         /* tp_clear */
     .tp_weaklistoffset=offsetof(PyGreenlet, weakreflist),  /* tp_weaklistoffset */
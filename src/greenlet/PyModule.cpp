@@ -34,24 +34,83 @@ mod_getcurrent(PyObject* UNUSED(module))
     return GET_THREAD_STATE().state().get_current().relinquish_ownership_o();
 }
 
+static const struct {
+    const char* name;
+    ThreadState::TraceEvent event;
+} trace_event_names[] = {
+    {"switch", ThreadState::TRACE_SWITCH},
+    {"throw", ThreadState::TRACE_THROW},
+    {"start", ThreadState::TRACE_START},
+    {"finish", ThreadState::TRACE_FINISH},
+};
+
 PyDoc_STRVAR(mod_settrace_doc,
-             "settrace(callback) -> object\n"
+             "settrace(callback, events=None, sample=1, randomly=False) -> object\n"
+             "\n"
+             "Sets a new tracing function and returns the previous one.\n"
              "\n"
-             "Sets a new tracing function and returns the previous one.\n");
+             "*events* names the events it's called for, from ``'switch'``,\n"
+             "``'throw'``, ``'start'`` and ``'finish'``; by default, the first two.\n"
+             "If *sample* is greater than 1, it's called for only one in that many\n"
+             "of them: every *sample*-th, or, if *randomly* is true, each with a\n"
+             "chance of one in *sample*. Events that are filtered out or skipped\n"
+             "don't cost a call into Python.\n"
+             "\n"
+             "Only the function is returned, so ``settrace(old)`` restores it with\n"
+             "the default *events* and *sample*; to put back everything, save\n"
+             "``gettrace_config()`` first and pass it back as ``settrace(**config)``.\n");
 static PyObject*
-mod_settrace(PyObject* UNUSED(module), PyObject* args)
+mod_settrace(PyObject* UNUSED(module), PyObject* args, PyObject* kwargs)
 {
+    static const char* kwlist[] = {"callback", "events", "sample", "randomly", nullptr};
     PyArgParseParam tracefunc;
-    if (!PyArg_ParseTuple(args, "O", &tracefunc)) {
+    PyArgParseParam events;
+    Py_ssize_t sample = 1;
+    int randomly = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|Onp:settrace",
+                                     const_cast<char**>(kwlist),
+                                     &tracefunc, &events, &sample, &randomly)) {
+        return NULL;
+    }
+    if (sample < 1 || static_cast<size_t>(sample) > std::numeric_limits<unsigned int>::max()) {
+        PyErr_SetString(PyExc_ValueError, "sample must be a positive integer");
         return NULL;
     }
+    unsigned int event_mask = ThreadState::TRACE_SWITCH | ThreadState::TRACE_THROW;
+    if (events && events != Py_None) {
+        NewReference iter(PyObject_GetIter(events));
+        if (!iter) {
+            return NULL;
+        }
+        event_mask = 0;
+        while (PyObject* const item = PyIter_Next(iter.borrow())) {
+            const NewReference owned_item(item);
+            unsigned int event = 0;
+            if (PyUnicode_Check(item)) {
+                for (const auto& event_name : trace_event_names) {
+                    if (PyUnicode_CompareWithASCIIString(item, event_name.name) == 0) {
+                        event = event_name.event;
+                        break;
+                    }
+                }
+            }
+            if (!event) {
+                PyErr_Format(PyExc_ValueError, "Unknown trace event %R", item);
+                return NULL;
+            }
+            event_mask |= event;
+        }
+        if (PyErr_Occurred()) {
+            return NULL;
+        }
+    }
     ThreadState& state = GET_THREAD_STATE();
     OwnedObject previous = state.get_tracefunc();
     if (!previous) {
         previous = Py_None;
     }
 
-    state.set_tracefunc(tracefunc);
+    state.set_tracefunc(tracefunc, event_mask, static_cast<unsigned int>(sample), randomly);
 
     return previous.relinquish_ownership();
 }
@@ -71,6 +130,49 @@ mod_gettrace(PyObject* UNUSED(module))
     return tracefunc.relinquish_ownership();
 }
 
+PyDoc_STRVAR(mod_gettrace_config_doc,
+             "gettrace_config() -> dict\n"
+             "\n"
+             "Returns the arguments that ``settrace`` was last called with, as a\n"
+             "dict with the keys ``callback``, ``events`` (a tuple of names),\n"
+             "``sample`` and ``randomly``, so that ``settrace(**config)`` restores\n"
+             "them.\n");
+
+static PyObject*
+mod_gettrace_config(PyObject* UNUSED(module))
+{
+    const ThreadState& state = GET_THREAD_STATE().state();
+    OwnedObject tracefunc = state.get_tracefunc();
+    if (!tracefunc) {
+        tracefunc = Py_None;
+    }
+    Py_ssize_t count = 0;
+    for (const auto& event_name : trace_event_names) {
+        if (state.trace_events() & event_name.event) {
+            ++count;
+        }
+    }
+    NewReference events(PyTuple_New(count));
+    if (!events) {
+        return NULL;
+    }
+    count = 0;
+    for (const auto& event_name : trace_event_names) {
+        if (state.trace_events() & event_name.event) {
+            PyObject* const name = PyUnicode_FromString(event_name.name);
+            if (!name) {
+                return NULL;
+            }
+            PyTuple_SET_ITEM(events.borrow(), count++, name);
+        }
+    }
+    return Py_BuildValue("{s:O,s:O,s:I,s:O}",
+                         "callback", tracefunc.borrow(),
+                         "events", events.borrow(),
+                         "sample", state.trace_sample(),
+                         "randomly", state.trace_sample_randomly() ? Py_True : Py_False);
+}
+
 
 
 PyDoc_STRVAR(mod_set_thread_local_doc,
@@ -186,6 +288,663 @@ mod_enable_optional_cleanup(PyObject* UNUSED(module), PyObject* flag)
     Py_RETURN_NONE;
 }
 
+PyDoc_STRVAR(mod_get_stack_copy_pool_stats_doc,
+             "get_stack_copy_pool_stats() -> dict\n"
+             "\n"
+             "Return information about the pool of buffers that the current thread\n"
+             "uses to hold the saved stacks of suspended greenlets.\n"
+             "The keys are ``pooled_bytes`` and ``pooled_buffers`` (what the pool\n"
+             "is holding on to right now), ``hits`` and ``misses`` (how many buffers\n"
+             "were taken from the pool and how many had to be allocated), and\n"
+             "``limit`` and ``retention_limit`` (see ``set_stack_copy_pool_limit``\n"
+             "and ``set_stack_copy_retention_limit``).\n"
+             "\n"
+             "It also reports on the saved stacks themselves: ``saved_stacks`` and\n"
+             "``saved_bytes`` for those held as they are, ``packed_stacks``,\n"
+             "``packed_bytes`` and ``packed_saved_bytes`` (what those would take\n"
+             "unpacked) for those that have been packed, ``packs`` and ``unpacks``\n"
+             "(how many times that happened) and ``unpack_ns`` (the total time\n"
+             "spent unpacking, in nanoseconds), along with ``packing_limit`` and\n"
+             "``packing_idle`` (see ``set_stack_copy_packing_limit`` and\n"
+             "``set_stack_copy_packing_idle``).\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_get_stack_copy_pool_stats(PyObject* UNUSED(module))
+{
+    const greenlet::StackCopyPool& pool = GET_THREAD_STATE().state().stack_copy_pool();
+    const int64_t idle_ns = greenlet::StackCopyPool::packing_idle_ns();
+    return Py_BuildValue("{s:n,s:n,s:n,s:n,s:N,s:N,"
+                         "s:n,s:n,s:n,s:n,s:n,s:n,s:n,s:L,s:N,s:d}",
+                         "pooled_bytes", (Py_ssize_t)pool.pooled_bytes(),
+                         "pooled_buffers", (Py_ssize_t)pool.pooled_buffers(),
+                         "hits", (Py_ssize_t)pool.hits(),
+                         "misses", (Py_ssize_t)pool.misses(),
+                         "limit", PyLong_FromSize_t(greenlet::StackCopyPool::limit()),
+                         "retention_limit", PyLong_FromSize_t(greenlet::StackState::retention_limit()),
+                         "saved_stacks", (Py_ssize_t)pool.saved_stacks(),
+                         "saved_bytes", (Py_ssize_t)pool.saved_bytes(),
+                         "packed_stacks", (Py_ssize_t)pool.packed_stacks(),
+                         "packed_bytes", (Py_ssize_t)pool.packed_bytes(),
+                         "packed_saved_bytes", (Py_ssize_t)pool.packed_saved_bytes(),
+                         "packs", (Py_ssize_t)pool.packs(),
+                         "unpacks", (Py_ssize_t)pool.unpacks(),
+                         "unpack_ns", (long long)pool.unpack_ns(),
+                         "packing_limit", PyLong_FromSize_t(greenlet::StackCopyPool::packing_limit()),
+                         "packing_idle", idle_ns < 0 ? -1.0 : idle_ns / 1e9);
+}
+
+PyDoc_STRVAR(mod_set_stack_copy_pool_limit_doc,
+             "set_stack_copy_pool_limit(nbytes) -> Integer\n"
+             "\n"
+             "Set the most memory, in bytes, that each thread will keep in its pool of\n"
+             "unused saved-stack buffers, and return the previous limit. Setting\n"
+             "this to 0 disables pooling. The pool of the current thread is\n"
+             "trimmed to the new limit immediately; other threads trim lazily.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_set_stack_copy_pool_limit(PyObject* UNUSED(module), PyObject* nbytes)
+{
+    const size_t limit = PyLong_AsSize_t(nbytes);
+    if (limit == (size_t)-1 && PyErr_Occurred()) {
+        return nullptr;
+    }
+    const size_t previous = greenlet::StackCopyPool::limit();
+    greenlet::StackCopyPool::set_limit(limit);
+    GET_THREAD_STATE().state().stack_copy_pool().trim(limit);
+    return PyLong_FromSize_t(previous);
+}
+
+PyDoc_STRVAR(mod_set_stack_copy_retention_limit_doc,
+             "set_stack_copy_retention_limit(nbytes) -> Integer\n"
+             "\n"
+             "When a suspended greenlet resumes, it normally gives the buffer holding\n"
+             "its saved stack back to the pool. If that buffer is no bigger than\n"
+             "*nbytes*, the greenlet keeps it instead, to reuse the next time it\n"
+             "switches away. This saves work for greenlets that switch often, at the\n"
+             "cost of memory held by greenlets that are running or have stopped\n"
+             "switching. The default, 0, disables this. Returns the previous limit.\n"
+             "Buffers that greenlets have already kept are unaffected by lowering\n"
+             "the limit until they are next restored.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_set_stack_copy_retention_limit(PyObject* UNUSED(module), PyObject* nbytes)
+{
+    const size_t limit = PyLong_AsSize_t(nbytes);
+    if (limit == (size_t)-1 && PyErr_Occurred()) {
+        return nullptr;
+    }
+    const size_t previous = greenlet::StackState::retention_limit();
+    greenlet::StackState::set_retention_limit(limit);
+    return PyLong_FromSize_t(previous);
+}
+
+PyDoc_STRVAR(mod_set_stack_copy_packing_limit_doc,
+             "set_stack_copy_packing_limit(nbytes) -> Integer\n"
+             "\n"
+             "When the stacks saved by the suspended greenlets of a thread take more\n"
+             "than *nbytes*, pack the ones that have been suspended longest until\n"
+             "they don't. Packing drops the runs of zeros that make up much of a\n"
+             "typical saved stack; the stack is unpacked when its greenlet resumes,\n"
+             "or needs to save more of it. The default is the largest possible size,\n"
+             "meaning never. Returns the previous limit. The limit is checked after\n"
+             "each switch.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_set_stack_copy_packing_limit(PyObject* UNUSED(module), PyObject* nbytes)
+{
+    const size_t limit = PyLong_AsSize_t(nbytes);
+    if (limit == (size_t)-1 && PyErr_Occurred()) {
+        return nullptr;
+    }
+    const size_t previous = greenlet::StackCopyPool::packing_limit();
+    greenlet::StackCopyPool::set_packing_limit(limit);
+    return PyLong_FromSize_t(previous);
+}
+
+PyDoc_STRVAR(mod_set_stack_copy_packing_idle_doc,
+             "set_stack_copy_packing_idle(seconds) -> float\n"
+             "\n"
+             "Pack the saved stacks of greenlets that have been suspended for more\n"
+             "than *seconds* (see ``set_stack_copy_packing_limit``). A negative\n"
+             "number, the default, means never. Returns the previous setting.\n"
+             "This is checked after each switch, so a thread that stops switching\n"
+             "doesn't pack anything. Greenlets that were already suspended when\n"
+             "this is first set count as having been idle forever.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_set_stack_copy_packing_idle(PyObject* UNUSED(module), PyObject* seconds)
+{
+    const double s = PyFloat_AsDouble(seconds);
+    if (s == -1.0 && PyErr_Occurred()) {
+        return nullptr;
+    }
+    if (s != s || s >= 9e9) {
+        PyErr_SetString(PyExc_ValueError, "seconds must be a finite number less than 9e9");
+        return nullptr;
+    }
+    const int64_t previous = greenlet::StackCopyPool::packing_idle_ns();
+    greenlet::StackCopyPool::set_packing_idle_ns(s < 0 ? -1 : (int64_t)(s * 1e9));
+    return PyFloat_FromDouble(previous < 0 ? -1.0 : previous / 1e9);
+}
+
+PyDoc_STRVAR(mod_trim_stack_copy_pool_doc,
+             "trim_stack_copy_pool() -> Integer\n"
+             "\n"
+             "Free all the unused saved-stack buffers the current thread is holding,\n"
+             "and return the number of bytes released.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_trim_stack_copy_pool(PyObject* UNUSED(module))
+{
+    return PyLong_FromSize_t(GET_THREAD_STATE().state().stack_copy_pool().trim());
+}
+
+PyDoc_STRVAR(mod_get_saved_stack_stats_doc,
+             "get_saved_stack_stats() -> dict\n"
+             "\n"
+             "Return how much memory the suspended greenlets of the current thread\n"
+             "are using to hold their saved stacks. The keys are ``greenlets`` (how\n"
+             "many have part of their stack saved), ``bytes`` (the memory that takes,\n"
+             "counting packed stacks at their packed size), and ``budget`` and\n"
+             "``budget_calls`` (see ``set_saved_stack_budget``). This is cheap\n"
+             "enough to call often.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_get_saved_stack_stats(PyObject* UNUSED(module))
+{
+    ThreadState& state = GET_THREAD_STATE().state();
+    const greenlet::StackCopyPool& pool = state.stack_copy_pool();
+    return Py_BuildValue("{s:n,s:n,s:N,s:n}",
+                         "greenlets", (Py_ssize_t)(pool.saved_stacks() + pool.packed_stacks()),
+                         "bytes", (Py_ssize_t)pool.saved_memory(),
+                         "budget", PyLong_FromSize_t(state.saved_stack_budget()),
+                         "budget_calls", (Py_ssize_t)state.saved_stack_budget_calls());
+}
+
+PyDoc_STRVAR(mod_set_saved_stack_budget_doc,
+             "set_saved_stack_budget(nbytes, callback) -> Integer\n"
+             "\n"
+             "Set a soft limit on the memory used by the saved stacks of the current\n"
+             "thread's suspended greenlets (the ``bytes`` of ``get_saved_stack_stats``),\n"
+             "and return the previous limit. When a switch finishes with the saved\n"
+             "stacks over *nbytes*, *callback* is called in the greenlet that was\n"
+             "switched to, with the number of bytes in use. It's not called again until\n"
+             "the saved stacks have gone back under the limit. Nothing is freed\n"
+             "automatically; the callback might, for example, kill idle greenlets or\n"
+             "turn on packing with ``set_stack_copy_packing_limit``. Exceptions raised\n"
+             "by the callback are reported with ``sys.unraisablehook``. Passing\n"
+             "``None`` as the callback removes it. There is no limit by default.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_set_saved_stack_budget(PyObject* UNUSED(module), PyObject* args)
+{
+    PyObject* nbytes;
+    PyArgParseParam callback;
+    if (!PyArg_ParseTuple(args, "OO", &nbytes, &callback)) {
+        return nullptr;
+    }
+    const size_t budget = PyLong_AsSize_t(nbytes);
+    if (budget == (size_t)-1 && PyErr_Occurred()) {
+        return nullptr;
+    }
+    if (callback != Py_None && !PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "callback must be callable or None");
+        return nullptr;
+    }
+    ThreadState& state = GET_THREAD_STATE().state();
+    const size_t previous = state.saved_stack_budget();
+    state.set_saved_stack_budget(budget, callback);
+    return PyLong_FromSize_t(previous);
+}
+
+PyDoc_STRVAR(mod_get_dedicated_stack_pool_stats_doc,
+             "get_dedicated_stack_pool_stats() -> dict\n"
+             "\n"
+             "Return information about the stacks that the current thread has mapped\n"
+             "for greenlets created with a ``stack_size``. The keys are\n"
+             "``in_use_stacks`` and ``in_use_bytes`` (stacks that greenlets are\n"
+             "using), ``pooled_stacks`` and ``pooled_bytes`` (unused stacks kept\n"
+             "for reuse), ``resident_bytes`` (how much of the memory of both is\n"
+             "actually resident), ``hits`` and ``misses`` (how many stacks were\n"
+             "reused and how many had to be mapped), and ``limit`` and\n"
+             "``resident_limit`` (see ``set_dedicated_stack_pool_limit`` and\n"
+             "``set_dedicated_stack_pool_resident_limit``). Sizes include guard\n"
+             "pages.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_get_dedicated_stack_pool_stats(PyObject* UNUSED(module))
+{
+#if GREENLET_USE_DEDICATED_STACKS
+    const greenlet::DedicatedStackPool* const pool = GET_THREAD_STATE().state().borrow_dedicated_stack_pool();
+    return Py_BuildValue("{s:n,s:n,s:n,s:n,s:n,s:n,s:n,s:N,s:N}",
+                         "in_use_stacks", (Py_ssize_t)(pool ? pool->in_use_stacks() : 0),
+                         "in_use_bytes", (Py_ssize_t)(pool ? pool->in_use_bytes() : 0),
+                         "pooled_stacks", (Py_ssize_t)(pool ? pool->pooled_stacks() : 0),
+                         "pooled_bytes", (Py_ssize_t)(pool ? pool->pooled_bytes() : 0),
+                         "resident_bytes", (Py_ssize_t)(pool ? pool->resident_bytes() : 0),
+                         "hits", (Py_ssize_t)(pool ? pool->hits() : 0),
+                         "misses", (Py_ssize_t)(pool ? pool->misses() : 0),
+                         "limit", PyLong_FromSize_t(greenlet::DedicatedStackPool::limit()),
+                         "resident_limit", PyLong_FromSize_t(greenlet::DedicatedStackPool::resident_limit()));
+#else
+    return Py_BuildValue("{s:n,s:n,s:n,s:n,s:n,s:n,s:n,s:n,s:n}",
+                         "in_use_stacks", (Py_ssize_t)0,
+                         "in_use_bytes", (Py_ssize_t)0,
+                         "pooled_stacks", (Py_ssize_t)0,
+                         "pooled_bytes", (Py_ssize_t)0,
+                         "resident_bytes", (Py_ssize_t)0,
+                         "hits", (Py_ssize_t)0,
+                         "misses", (Py_ssize_t)0,
+                         "limit", (Py_ssize_t)0,
+                         "resident_limit", (Py_ssize_t)0);
+#endif
+}
+
+PyDoc_STRVAR(mod_set_dedicated_stack_pool_limit_doc,
+             "set_dedicated_stack_pool_limit(nbytes) -> Integer\n"
+             "\n"
+             "Set the most address space, in bytes, that each thread will keep mapped\n"
+             "for unused dedicated stacks, and return the previous limit. Setting this\n"
+             "to 0 unmaps stacks as soon as they're unused. The pool of the current\n"
+             "thread is trimmed to the new limit immediately; other threads trim\n"
+             "lazily.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_set_dedicated_stack_pool_limit(PyObject* UNUSED(module), PyObject* nbytes)
+{
+    const size_t limit = PyLong_AsSize_t(nbytes);
+    if (limit == (size_t)-1 && PyErr_Occurred()) {
+        return nullptr;
+    }
+#if GREENLET_USE_DEDICATED_STACKS
+    const size_t previous = greenlet::DedicatedStackPool::limit();
+    greenlet::DedicatedStackPool::set_limit(limit);
+    if (greenlet::DedicatedStackPool* const pool = GET_THREAD_STATE().state().borrow_dedicated_stack_pool()) {
+        pool->trim(limit);
+    }
+    return PyLong_FromSize_t(previous);
+#else
+    return PyLong_FromSize_t(0);
+#endif
+}
+
+PyDoc_STRVAR(mod_set_dedicated_stack_pool_resident_limit_doc,
+             "set_dedicated_stack_pool_resident_limit(nbytes) -> Integer\n"
+             "\n"
+             "Unused dedicated stacks that a thread keeps beyond this many bytes have\n"
+             "their memory given back to the operating system (they keep their\n"
+             "address space, and are faulted back in when reused). Returns the\n"
+             "previous limit. This applies to stacks as they become unused.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_set_dedicated_stack_pool_resident_limit(PyObject* UNUSED(module), PyObject* nbytes)
+{
+    const size_t limit = PyLong_AsSize_t(nbytes);
+    if (limit == (size_t)-1 && PyErr_Occurred()) {
+        return nullptr;
+    }
+#if GREENLET_USE_DEDICATED_STACKS
+    const size_t previous = greenlet::DedicatedStackPool::resident_limit();
+    greenlet::DedicatedStackPool::set_resident_limit(limit);
+    return PyLong_FromSize_t(previous);
+#else
+    return PyLong_FromSize_t(0);
+#endif
+}
+
+PyDoc_STRVAR(mod_trim_dedicated_stack_pool_doc,
+             "trim_dedicated_stack_pool() -> Integer\n"
+             "\n"
+             "Unmap all the unused dedicated stacks the current thread is keeping,\n"
+             "and return the number of bytes released.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_trim_dedicated_stack_pool(PyObject* UNUSED(module))
+{
+#if GREENLET_USE_DEDICATED_STACKS
+    if (greenlet::DedicatedStackPool* const pool = GET_THREAD_STATE().state().borrow_dedicated_stack_pool()) {
+        return PyLong_FromSize_t(pool->trim());
+    }
+#endif
+    return PyLong_FromSize_t(0);
+}
+
+PyDoc_STRVAR(mod_enable_switch_stats_doc,
+             "enable_switch_stats(flag) -> None\n"
+             "\n"
+             "Start keeping statistics about the switches made in the current thread,\n"
+             "from zero (even if they were already being kept), or, if *flag* is\n"
+             "false, stop and discard them. They aren't kept by default.\n"
+             "See ``get_switch_stats``.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_enable_switch_stats(PyObject* UNUSED(module), PyObject* flag)
+{
+    const int is_true = PyObject_IsTrue(flag);
+    if (is_true == -1) {
+        return nullptr;
+    }
+    try {
+        GET_THREAD_STATE().state().enable_switch_stats(is_true);
+    }
+    catch (const std::bad_alloc&) {
+        return PyErr_NoMemory();
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(mod_get_switch_stats_doc,
+             "get_switch_stats() -> dict or None\n"
+             "\n"
+             "Return the statistics kept about the switches made in the current\n"
+             "thread since ``enable_switch_stats`` was called, or None if they\n"
+             "aren't being kept. The keys are ``switches`` (how many switches changed\n"
+             "stacks), ``switch_ns`` and ``max_ns`` (the total and longest time taken\n"
+             "to change stacks, in nanoseconds, including saving and restoring them),\n"
+             "``copied_to_heap`` and ``copied_to_stack`` (how many bytes of stack\n"
+             "were saved and restored), and ``histogram``, a list whose item *i*\n"
+             "counts the switches that took less than 2**i nanoseconds, and, if\n"
+             "*i* isn't 0, at least 2**(i-1); it leaves off the empty buckets at the\n"
+             "end.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_get_switch_stats(PyObject* UNUSED(module))
+{
+    const greenlet::SwitchStats* const stats = GET_THREAD_STATE().state().switch_stats();
+    if (!stats) {
+        Py_RETURN_NONE;
+    }
+    unsigned int nbuckets = greenlet::SwitchStats::NUM_BUCKETS;
+    while (nbuckets && !stats->bucket(nbuckets - 1)) {
+        --nbuckets;
+    }
+    PyObject* histogram = PyList_New(nbuckets);
+    if (!histogram) {
+        return nullptr;
+    }
+    for (unsigned int i = 0; i < nbuckets; ++i) {
+        PyObject* const count = PyLong_FromSize_t(stats->bucket(i));
+        if (!count) {
+            Py_DECREF(histogram);
+            return nullptr;
+        }
+        PyList_SET_ITEM(histogram, i, count);
+    }
+    return Py_BuildValue("{s:n,s:L,s:L,s:n,s:n,s:N}",
+                         "switches", (Py_ssize_t)stats->switches(),
+                         "switch_ns", (long long)stats->switch_ns(),
+                         "max_ns", (long long)stats->max_ns(),
+                         "copied_to_heap", (Py_ssize_t)stats->copied_to_heap(),
+                         "copied_to_stack", (Py_ssize_t)stats->copied_to_stack(),
+                         "histogram", histogram);
+}
+
+PyDoc_STRVAR(mod_enable_switch_history_doc,
+             "enable_switch_history(size) -> None\n"
+             "\n"
+             "Start keeping a record of the *size* most recent switches made in the\n"
+             "current thread, discarding any that were already recorded, or, if\n"
+             "*size* is 0, stop. They aren't recorded by default. The memory for the\n"
+             "record is allocated now; recording a switch takes little more than\n"
+             "reading the clock.\n"
+             "See ``get_switch_history`` and ``dump_switch_history``.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_enable_switch_history(PyObject* UNUSED(module), PyObject* size)
+{
+    const size_t capacity = PyLong_AsSize_t(size);
+    if (capacity == (size_t)-1 && PyErr_Occurred()) {
+        return nullptr;
+    }
+    try {
+        GET_THREAD_STATE().state().enable_switch_history(capacity);
+    }
+    catch (const std::bad_alloc&) {
+        return PyErr_NoMemory();
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(mod_get_switch_history_doc,
+             "get_switch_history() -> list or None\n"
+             "\n"
+             "Return the switches recorded in the current thread since\n"
+             "``enable_switch_history`` was called, oldest first, or None if they\n"
+             "aren't being recorded. Each is a tuple ``(ns, origin, target, event,\n"
+             "saved)``: when it happened, in nanoseconds from a monotonic clock, the\n"
+             "``id()`` of the greenlets switched from and to (which may no longer\n"
+             "exist), ``'switch'`` or ``'throw'``, and the number of bytes of the\n"
+             "origin's stack that had been saved once it was done.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_get_switch_history(PyObject* UNUSED(module))
+{
+    const greenlet::SwitchHistory* const history = GET_THREAD_STATE().state().switch_history();
+    if (!history) {
+        Py_RETURN_NONE;
+    }
+    // Take a copy first: creating the tuples could run arbitrary
+    // code that switches, adding entries.
+    std::vector<greenlet::SwitchHistory::Entry> entries;
+    try {
+        entries.reserve(history->size());
+        for (size_t i = 0; i < history->size(); ++i) {
+            entries.push_back(history->at(i));
+        }
+    }
+    catch (const std::bad_alloc&) {
+        return PyErr_NoMemory();
+    }
+    PyObject* result = PyList_New(entries.size());
+    if (!result) {
+        return nullptr;
+    }
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const greenlet::SwitchHistory::Entry& entry = entries[i];
+        PyObject* const item = Py_BuildValue(
+            "(LNNOn)",
+            (long long)entry.ns,
+            PyLong_FromVoidPtr(const_cast<PyGreenlet*>(entry.origin)),
+            PyLong_FromVoidPtr(const_cast<PyGreenlet*>(entry.target)),
+            entry.event == PyGreenlet_TRACE_THROW
+            ? mod_globs->event_throw.borrow()
+            : mod_globs->event_switch.borrow(),
+            (Py_ssize_t)entry.saved);
+        if (!item) {
+            Py_DECREF(result);
+            return nullptr;
+        }
+        PyList_SET_ITEM(result, i, item);
+    }
+    return result;
+}
+
+PyDoc_STRVAR(mod_dump_switch_history_doc,
+             "dump_switch_history(fd) -> bool\n"
+             "\n"
+             "Write the switches recorded in the current thread to the file\n"
+             "descriptor *fd* as text, oldest first, one per line, with the\n"
+             "greenlets identified by their ``id()`` in hex. Returns whether they\n"
+             "are being recorded; if not, nothing is written.\n"
+             "\n"
+             "This doesn't need to allocate memory, so it can be used when things\n"
+             "are going badly wrong; C code (a fatal error handler, say) can use\n"
+             "``PyGreenlet_DumpSwitchHistory``, which doesn't need the GIL either.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_dump_switch_history(PyObject* UNUSED(module), PyObject* fileno)
+{
+    const int fd = PyObject_AsFileDescriptor(fileno);
+    if (fd < 0) {
+        return nullptr;
+    }
+    const greenlet::SwitchHistory* const history = GET_THREAD_STATE().state().switch_history();
+    if (!history) {
+        Py_RETURN_FALSE;
+    }
+    history->dump(fd);
+    Py_RETURN_TRUE;
+}
+
+PyDoc_STRVAR(mod_enable_greenlet_accounting_doc,
+             "enable_greenlet_accounting(flag) -> None\n"
+             "\n"
+             "Start accounting the time spent running to the greenlets of the\n"
+             "current thread, in their ``gr_cpu_time``, ``gr_switch_count`` and\n"
+             "``gr_last_resumed``, with the thread's totals from zero (even if it\n"
+             "was already enabled), or, if *flag* is false, stop. The greenlets keep\n"
+             "what they've accumulated either way. It isn't enabled by default; when\n"
+             "it is, each switch reads the clock once more.\n"
+             "See ``get_greenlet_accounting``.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_enable_greenlet_accounting(PyObject* UNUSED(module), PyObject* flag)
+{
+    const int is_true = PyObject_IsTrue(flag);
+    if (is_true == -1) {
+        return nullptr;
+    }
+    GET_THREAD_STATE().state().enable_accounting(is_true);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(mod_get_greenlet_accounting_doc,
+             "get_greenlet_accounting() -> dict or None\n"
+             "\n"
+             "Return the totals accounted to the greenlets of the current thread\n"
+             "since ``enable_greenlet_accounting`` was called, or None if it isn't\n"
+             "enabled. The keys are ``cpu_time`` (the seconds they've spent running,\n"
+             "including the current greenlet so far) and ``switches`` (how many\n"
+             "times one was resumed).\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_get_greenlet_accounting(PyObject* UNUSED(module))
+{
+    const ThreadState& state = GET_THREAD_STATE().state();
+    if (!state.accounting_enabled()) {
+        Py_RETURN_NONE;
+    }
+    const int64_t run_ns = state.accounted_ns()
+        + (greenlet::SwitchStats::now_ns() - state.resumed_ns());
+    return Py_BuildValue("{s:d,s:K}",
+                         "cpu_time", run_ns / 1e9,
+                         "switches", (unsigned long long)state.accounted_switches());
+}
+
+PyDoc_STRVAR(mod_set_blocking_watchdog_doc,
+             "set_blocking_watchdog(seconds, callback) -> None\n"
+             "\n"
+             "Watch the current thread for a greenlet that runs for more than\n"
+             "*seconds* without switching, stalling the others. A background\n"
+             "thread, started when first needed, does the watching; it doesn't\n"
+             "involve any tracing, and the only cost to switching is reading the\n"
+             "clock. When a greenlet is found to have run too long, the next time\n"
+             "the main thread runs Python code, if the greenlet still hasn't\n"
+             "switched, *callback* is called there with the greenlet, how many\n"
+             "seconds it has been running, and the ``traceback.StackSummary`` of\n"
+             "where it is now (or None if that can't be found). This happens once\n"
+             "each time a greenlet overruns. Exceptions raised by the callback are\n"
+             "reported with ``sys.unraisablehook``. Calling this again replaces the\n"
+             "threshold and callback; passing ``None`` as the callback stops\n"
+             "watching. This isn't available in free-threaded builds.\n"
+             "\n"
+             "This is an implementation specific, provisional API. It may be changed or removed\n"
+             "in the future.\n"
+             );
+static PyObject*
+mod_set_blocking_watchdog(PyObject* UNUSED(module), PyObject* args)
+{
+    double seconds;
+    PyArgParseParam callback;
+    if (!PyArg_ParseTuple(args, "dO", &seconds, &callback)) {
+        return nullptr;
+    }
+#ifdef Py_GIL_DISABLED
+    // Without the GIL, nothing stops the watched thread from
+    // switching while the report is being made.
+    PyErr_SetString(PyExc_NotImplementedError,
+                    "set_blocking_watchdog is not available in free-threaded builds");
+    return nullptr;
+#else
+    if (callback != Py_None && !PyCallable_Check(callback)) {
+        PyErr_SetString(PyExc_TypeError, "callback must be callable or None");
+        return nullptr;
+    }
+    if (!(seconds > 0 && seconds < 1e9)) {
+        PyErr_SetString(PyExc_ValueError, "seconds must be positive");
+        return nullptr;
+    }
+    try {
+        GET_THREAD_STATE().state().set_blocking_watchdog(
+            static_cast<int64_t>(seconds * 1e9), callback);
+    }
+    catch (const std::bad_alloc&) {
+        return PyErr_NoMemory();
+    }
+    catch (const PyErrOccurred&) {
+        return nullptr;
+    }
+    Py_RETURN_NONE;
+#endif
+}
+
 
 
 
@@ -220,7 +979,7 @@ static PyMethodDef GreenMethods[] = {
     {
       .ml_name="settrace",
       .ml_meth=(PyCFunction)mod_settrace,
-      .ml_flags=METH_VARARGS,
+      .ml_flags=METH_VARARGS | METH_KEYWORDS,
       .ml_doc=mod_settrace_doc
     },
     {
@@ -229,6 +988,12 @@ static PyMethodDef GreenMethods[] = {
       .ml_flags=METH_NOARGS,
       .ml_doc=mod_gettrace_doc
     },
+    {
+      .ml_name="gettrace_config",
+      .ml_meth=(PyCFunction)mod_gettrace_config,
+      .ml_flags=METH_NOARGS,
+      .ml_doc=mod_gettrace_config_doc
+    },
     {
       .ml_name="set_thread_local",
       .ml_meth=(PyCFunction)mod_set_thread_local,
@@ -259,6 +1024,126 @@ static PyMethodDef GreenMethods[] = {
       .ml_flags=METH_O,
       .ml_doc=mod_enable_optional_cleanup_doc
     },
+    {
+      .ml_name="get_stack_copy_pool_stats",
+      .ml_meth=(PyCFunction)mod_get_stack_copy_pool_stats,
+      .ml_flags=METH_NOARGS,
+      .ml_doc=mod_get_stack_copy_pool_stats_doc
+    },
+    {
+      .ml_name="set_stack_copy_pool_limit",
+      .ml_meth=(PyCFunction)mod_set_stack_copy_pool_limit,
+      .ml_flags=METH_O,
+      .ml_doc=mod_set_stack_copy_pool_limit_doc
+    },
+    {
+      .ml_name="set_stack_copy_retention_limit",
+      .ml_meth=(PyCFunction)mod_set_stack_copy_retention_limit,
+      .ml_flags=METH_O,
+      .ml_doc=mod_set_stack_copy_retention_limit_doc
+    },
+    {
+      .ml_name="set_stack_copy_packing_limit",
+      .ml_meth=(PyCFunction)mod_set_stack_copy_packing_limit,
+      .ml_flags=METH_O,
+      .ml_doc=mod_set_stack_copy_packing_limit_doc
+    },
+    {
+      .ml_name="set_stack_copy_packing_idle",
+      .ml_meth=(PyCFunction)mod_set_stack_copy_packing_idle,
+      .ml_flags=METH_O,
+      .ml_doc=mod_set_stack_copy_packing_idle_doc
+    },
+    {
+      .ml_name="trim_stack_copy_pool",
+      .ml_meth=(PyCFunction)mod_trim_stack_copy_pool,
+      .ml_flags=METH_NOARGS,
+      .ml_doc=mod_trim_stack_copy_pool_doc
+    },
+    {
+      .ml_name="get_saved_stack_stats",
+      .ml_meth=(PyCFunction)mod_get_saved_stack_stats,
+      .ml_flags=METH_NOARGS,
+      .ml_doc=mod_get_saved_stack_stats_doc
+    },
+    {
+      .ml_name="set_saved_stack_budget",
+      .ml_meth=(PyCFunction)mod_set_saved_stack_budget,
+      .ml_flags=METH_VARARGS,
+      .ml_doc=mod_set_saved_stack_budget_doc
+    },
+    {
+      .ml_name="get_dedicated_stack_pool_stats",
+      .ml_meth=(PyCFunction)mod_get_dedicated_stack_pool_stats,
+      .ml_flags=METH_NOARGS,
+      .ml_doc=mod_get_dedicated_stack_pool_stats_doc
+    },
+    {
+      .ml_name="set_dedicated_stack_pool_limit",
+      .ml_meth=(PyCFunction)mod_set_dedicated_stack_pool_limit,
+      .ml_flags=METH_O,
+      .ml_doc=mod_set_dedicated_stack_pool_limit_doc
+    },
+    {
+      .ml_name="set_dedicated_stack_pool_resident_limit",
+      .ml_meth=(PyCFunction)mod_set_dedicated_stack_pool_resident_limit,
+      .ml_flags=METH_O,
+      .ml_doc=mod_set_dedicated_stack_pool_resident_limit_doc
+    },
+    {
+      .ml_name="trim_dedicated_stack_pool",
+      .ml_meth=(PyCFunction)mod_trim_dedicated_stack_pool,
+      .ml_flags=METH_NOARGS,
+      .ml_doc=mod_trim_dedicated_stack_pool_doc
+    },
+    {
+      .ml_name="enable_switch_stats",
+      .ml_meth=(PyCFunction)mod_enable_switch_stats,
+      .ml_flags=METH_O,
+      .ml_doc=mod_enable_switch_stats_doc
+    },
+    {
+      .ml_name="get_switch_stats",
+      .ml_meth=(PyCFunction)mod_get_switch_stats,
+      .ml_flags=METH_NOARGS,
+      .ml_doc=mod_get_switch_stats_doc
+    },
+    {
+      .ml_name="enable_switch_history",
+      .ml_meth=(PyCFunction)mod_enable_switch_history,
+      .ml_flags=METH_O,
+      .ml_doc=mod_enable_switch_history_doc
+    },
+    {
+      .ml_name="get_switch_history",
+      .ml_meth=(PyCFunction)mod_get_switch_history,
+      .ml_flags=METH_NOARGS,
+      .ml_doc=mod_get_switch_history_doc
+    },
+    {
+      .ml_name="dump_switch_history",
+      .ml_meth=(PyCFunction)mod_dump_switch_history,
+      .ml_flags=METH_O,
+      .ml_doc=mod_dump_switch_history_doc
+    },
+    {
+      .ml_name="enable_greenlet_accounting",
+      .ml_meth=(PyCFunction)mod_enable_greenlet_accounting,
+      .ml_flags=METH_O,
+      .ml_doc=mod_enable_greenlet_accounting_doc
+    },
+    {
+      .ml_name="get_greenlet_accounting",
+      .ml_meth=(PyCFunction)mod_get_greenlet_accounting,
+      .ml_flags=METH_NOARGS,
+      .ml_doc=mod_get_greenlet_accounting_doc
+    },
+    {
+      .ml_name="set_blocking_watchdog",
+      .ml_meth=(PyCFunction)mod_set_blocking_watchdog,
+      .ml_flags=METH_VARARGS,
+      .ml_doc=mod_set_blocking_watchdog_doc
+    },
 #if !GREENLET_PY313
     {
       .ml_name="get_tstate_trash_delete_nesting",
@@ -0,0 +1,344 @@
+/* -*- indent-tabs-mode: nil; tab-width: 4; -*- */
+#ifndef PY_RUN_QUEUE_CPP
+#define PY_RUN_QUEUE_CPP
+/**
+   Implementation of the Python slots for PyRunQueue_Type.
+
+   A run queue holds greenlets that are ready to run, along with what
+   to switch into each of them, and switches to them in order from C.
+   It's the innermost loop of every greenlet-based scheduler; doing it
+   here saves a trip through the interpreter, and packing the
+   arguments, for every switch.
+*/
+
+#include <deque>
+#include <new>
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "greenlet_internal.hpp"
+#include "greenlet_refs.hpp"
+#include "greenlet_allocator.hpp"
+#include "TGreenlet.hpp"
+#include "TThreadState.hpp"
+#include "PyGreenlet.hpp"
+
+using greenlet::PyErrOccurred;
+using greenlet::Require;
+using greenlet::ThreadState;
+
+namespace greenlet {
+    /**
+     * Called just before the switch to *glet* that *waker* scheduled;
+     * if it returns false, the switch has been cancelled and is
+     * skipped.
+     */
+    typedef bool (*run_queue_claim_t)(PyObject* waker, PyGreenlet* glet);
+
+    /**
+     * One scheduled switch. The queue owns the references.
+     */
+    struct RunQueueEntry
+    {
+        PyGreenlet* glet;
+        PyObject* args;
+        PyObject* kwargs;
+        // Both null unless scheduled by something that can cancel it.
+        PyObject* waker;
+        run_queue_claim_t claim;
+    };
+
+    typedef std::deque<RunQueueEntry, PythonAllocator<RunQueueEntry> > run_queue_t;
+};
+
+using greenlet::RunQueueEntry;
+using greenlet::run_queue_t;
+
+typedef struct {
+    PyObject_HEAD
+    // The main greenlet of the thread the queue belongs to. Only
+    // that thread can use it.
+    PyGreenlet* main_greenlet;
+    run_queue_t* entries;
+} PyRunQueue;
+
+
+static PyObject*
+runqueue_new(PyTypeObject* type, PyObject* args, PyObject* kwargs)
+{
+    if (PyTuple_GET_SIZE(args) || (kwargs && PyDict_GET_SIZE(kwargs))) {
+        PyErr_SetString(PyExc_TypeError, "RunQueue() takes no arguments");
+        return nullptr;
+    }
+    PyRunQueue* self = reinterpret_cast<PyRunQueue*>(type->tp_alloc(type, 0));
+    if (!self) {
+        return nullptr;
+    }
+    self->main_greenlet = GET_THREAD_STATE().state().borrow_main_greenlet().borrow();
+    Py_INCREF(self->main_greenlet);
+    self->entries = new (std::nothrow) run_queue_t;
+    if (!self->entries) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
+    return reinterpret_cast<PyObject*>(self);
+}
+
+static int
+runqueue_traverse(PyRunQueue* self, visitproc visit, void* arg)
+{
+    Py_VISIT(self->main_greenlet);
+    if (self->entries) {
+        for (const RunQueueEntry& entry : *self->entries) {
+            Py_VISIT(entry.glet);
+            Py_VISIT(entry.args);
+            Py_VISIT(entry.kwargs);
+            Py_VISIT(entry.waker);
+        }
+    }
+    return 0;
+}
+
+static int
+runqueue_clear(PyRunQueue* self)
+{
+    // Decref'ing can run arbitrary code, which might schedule
+    // things, so take the entries out first.
+    run_queue_t entries;
+    if (self->entries) {
+        entries.swap(*self->entries);
+    }
+    for (RunQueueEntry& entry : entries) {
+        Py_CLEAR(entry.glet);
+        Py_CLEAR(entry.args);
+        Py_CLEAR(entry.kwargs);
+        Py_CLEAR(entry.waker);
+    }
+    return 0;
+}
+
+static void
+runqueue_dealloc(PyRunQueue* self)
+{
+    PyObject_GC_UnTrack(self);
+    runqueue_clear(self);
+    delete self->entries;
+    self->entries = nullptr;
+    Py_CLEAR(self->main_greenlet);
+    Py_TYPE(self)->tp_free(reinterpret_cast<PyObject*>(self));
+}
+
+static bool
+runqueue_check_thread(PyRunQueue* self)
+{
+    if (GET_THREAD_STATE().state().borrow_main_greenlet().borrow() != self->main_greenlet) {
+        PyErr_SetString(mod_globs->PyExc_GreenletError,
+                        "cannot use a RunQueue from a different thread");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Add an entry, stealing the references to *args* and *kwargs*
+ * (which may be null) even on failure. If *claim* is given, it's
+ * asked whether to go ahead when the entry's turn comes.
+ */
+static bool
+runqueue_push(PyRunQueue* self, PyGreenlet* glet, PyObject* args, PyObject* kwargs,
+              PyObject* waker=nullptr, greenlet::run_queue_claim_t claim=nullptr)
+{
+    if (!args) {
+        Py_XDECREF(kwargs);
+        return false;
+    }
+    if (kwargs && !PyDict_GET_SIZE(kwargs)) {
+        Py_CLEAR(kwargs);
+    }
+    Py_INCREF(glet);
+    Py_XINCREF(waker);
+    try {
+        self->entries->push_back(RunQueueEntry{glet, args, kwargs, waker, claim});
+    }
+    catch (const std::bad_alloc&) {
+        Py_DECREF(glet);
+        Py_XDECREF(waker);
+        Py_DECREF(args);
+        Py_XDECREF(kwargs);
+        PyErr_NoMemory();
+        return false;
+    }
+    return true;
+}
+
+PyDoc_STRVAR(runqueue_spawn_doc,
+             "spawn(run, *args, **kwargs) -> greenlet\n"
+             "\n"
+             "Create a greenlet for *run* (its parent is the current greenlet),\n"
+             "schedule it to be started with *args* and *kwargs*, and return it.\n");
+
+static PyObject*
+runqueue_spawn(PyRunQueue* self, PyObject* args, PyObject* kwargs)
+{
+    if (!runqueue_check_thread(self)) {
+        return nullptr;
+    }
+    if (PyTuple_GET_SIZE(args) < 1) {
+        PyErr_SetString(PyExc_TypeError, "spawn() missing required argument 'run'");
+        return nullptr;
+    }
+    OwnedGreenlet glet = OwnedGreenlet::consuming(
+        PyGreenlet_New(PyTuple_GET_ITEM(args, 0), nullptr));
+    if (!glet) {
+        return nullptr;
+    }
+    Py_XINCREF(kwargs);
+    if (!runqueue_push(self,
+                       glet.borrow(),
+                       PyTuple_GetSlice(args, 1, PyTuple_GET_SIZE(args)),
+                       kwargs)) {
+        return nullptr;
+    }
+    return glet.relinquish_ownership_o();
+}
+
+PyDoc_STRVAR(runqueue_schedule_doc,
+             "schedule(glet, *args, **kwargs)\n"
+             "\n"
+             "Arrange for ``glet.switch(*args, **kwargs)`` to be called by\n"
+             "``run_until_empty``.\n");
+
+static PyObject*
+runqueue_schedule(PyRunQueue* self, PyObject* args, PyObject* kwargs)
+{
+    if (!runqueue_check_thread(self)) {
+        return nullptr;
+    }
+    if (PyTuple_GET_SIZE(args) < 1 || !PyGreenlet_Check(PyTuple_GET_ITEM(args, 0))) {
+        PyErr_SetString(PyExc_TypeError, "schedule() requires a greenlet as its first argument");
+        return nullptr;
+    }
+    Py_XINCREF(kwargs);
+    if (!runqueue_push(self,
+                       reinterpret_cast<PyGreenlet*>(PyTuple_GET_ITEM(args, 0)),
+                       PyTuple_GetSlice(args, 1, PyTuple_GET_SIZE(args)),
+                       kwargs)) {
+        return nullptr;
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(runqueue_run_until_empty_doc,
+             "run_until_empty() -> int\n"
+             "\n"
+             "Switch to each scheduled greenlet in turn, in the order they were\n"
+             "scheduled, until there are none left, and return how many switches\n"
+             "were made. Greenlets may schedule more while this runs. Switches\n"
+             "that a :class:`Channel` scheduled are skipped if the greenlet has been\n"
+             "resumed some other way in the meantime. Whatever is\n"
+             "passed back when a greenlet switches to the caller is discarded.\n"
+             "If a switch raises an exception, it propagates out of this method,\n"
+             "leaving the rest of the queue in place.\n");
+
+static PyObject*
+runqueue_run_until_empty(PyRunQueue* self, PyObject* UNUSED(args))
+{
+    if (!runqueue_check_thread(self)) {
+        return nullptr;
+    }
+    Py_ssize_t count = 0;
+    while (!self->entries->empty()) {
+        const RunQueueEntry entry = self->entries->front();
+        self->entries->pop_front();
+        const OwnedGreenlet glet = OwnedGreenlet::consuming(entry.glet);
+        const OwnedObject args = OwnedObject::consuming(entry.args);
+        const OwnedObject kwargs = OwnedObject::consuming(entry.kwargs);
+        const OwnedObject waker = OwnedObject::consuming(entry.waker);
+        if (entry.claim && !entry.claim(waker.borrow(), glet.borrow())) {
+            continue;
+        }
+        ++count;
+        // This is green_switch() without going through a method
+        // call.
+        const OwnedObject result = OwnedObject::consuming(
+            green_switch(glet.borrow(), args.borrow(), kwargs.borrow()));
+        if (!result) {
+            return nullptr;
+        }
+    }
+    return PyLong_FromSsize_t(count);
+}
+
+PyDoc_STRVAR(runqueue_clear_doc,
+             "clear()\n"
+             "\n"
+             "Forget everything that's been scheduled.\n");
+
+static PyObject*
+runqueue_clear_method(PyRunQueue* self, PyObject* UNUSED(args))
+{
+    runqueue_clear(self);
+    Py_RETURN_NONE;
+}
+
+static Py_ssize_t
+runqueue_len(PyRunQueue* self)
+{
+    return self->entries->size();
+}
+
+static PyMethodDef runqueue_methods[] = {
+    {
+      .ml_name="spawn",
+      .ml_meth=reinterpret_cast<PyCFunction>(runqueue_spawn),
+      .ml_flags=METH_VARARGS | METH_KEYWORDS,
+      .ml_doc=runqueue_spawn_doc
+    },
+    {
+      .ml_name="schedule",
+      .ml_meth=reinterpret_cast<PyCFunction>(runqueue_schedule),
+      .ml_flags=METH_VARARGS | METH_KEYWORDS,
+      .ml_doc=runqueue_schedule_doc
+    },
+    {
+      .ml_name="run_until_empty",
+      .ml_meth=(PyCFunction)runqueue_run_until_empty,
+      .ml_flags=METH_NOARGS,
+      .ml_doc=runqueue_run_until_empty_doc
+    },
+    {
+      .ml_name="clear",
+      .ml_meth=(PyCFunction)runqueue_clear_method,
+      .ml_flags=METH_NOARGS,
+      .ml_doc=runqueue_clear_doc
+    },
+    {.ml_name=NULL, .ml_meth=NULL} /* sentinel */
+};
+
+static PySequenceMethods runqueue_as_sequence = {
+    .sq_length=(lenfunc)runqueue_len,
+};
+
+PyTypeObject PyRunQueue_Type = {
+    .ob_base=PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name="greenlet.RunQueue",
+    .tp_basicsize=sizeof(PyRunQueue),
+    .tp_dealloc=(destructor)runqueue_dealloc,
+    .tp_as_sequence=&runqueue_as_sequence,
+    .tp_flags=G_TPFLAGS_DEFAULT,
+    .tp_doc="RunQueue() -> RunQueue\n\n"
+    "A first-in, first-out queue of greenlets that are ready to run,\n"
+    "belonging to the current thread, which switches to them from C.\n"
+    "\n"
+    "This is an implementation specific, provisional API. It may be changed or removed\n"
+    "in the future.\n",
+    .tp_traverse=(traverseproc)runqueue_traverse,
+    .tp_clear=(inquiry)runqueue_clear,
+    .tp_methods=runqueue_methods,
+    .tp_alloc=PyType_GenericAlloc,
+    .tp_new=(newfunc)runqueue_new,
+    .tp_free=PyObject_GC_Del,
+};
+
+#endif
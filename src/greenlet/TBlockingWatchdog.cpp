@@ -0,0 +1,325 @@
+#ifndef GREENLET_BLOCKING_WATCHDOG_CPP
+#define GREENLET_BLOCKING_WATCHDOG_CPP
+/**
+ * Implementation of greenlet::BlockingWatch and the watchdog thread
+ * that looks at them.
+ */
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <vector>
+#ifndef _WIN32
+#    include <unistd.h>
+#endif
+
+#include "TGreenlet.hpp"
+#include "TThreadState.hpp"
+#include "greenlet_thread_support.hpp"
+
+namespace greenlet {
+
+/**
+ * The single watchdog thread and the threads it watches. It's started
+ * (with ``_thread``, so the interpreter knows about it) when the
+ * first thread is watched, and exits when there are none. It waits
+ * without the GIL. Reports are made from a pending call, which runs
+ * with the GIL in the main thread; before 3.13, the watchdog takes
+ * the GIL briefly after scheduling one, to get it noticed.
+ */
+class BlockingWatchdog
+{
+private:
+    G_NO_COPIES_OF_CLS(BlockingWatchdog);
+    Mutex lock;
+    // Signalled when the watches change, or we should stop.
+    std::condition_variable wakeup;
+    // Signalled when the thread exits.
+    std::condition_variable exited;
+    std::vector<BlockingWatch*> watches;
+    bool running;
+    // Set while the thread needs the GIL: to get started, and to
+    // nudge the main thread. Once the interpreter is finalizing, it
+    // won't get it.
+    bool needs_gil;
+    bool stopping;
+    bool report_scheduled;
+    bool stop_at_exit;
+#ifndef _WIN32
+    // The process that started the thread; a child forked since
+    // doesn't have it.
+    pid_t running_pid;
+#endif
+
+    BlockingWatchdog()
+        : running(false),
+          needs_gil(false),
+          stopping(false),
+          report_scheduled(false),
+          stop_at_exit(false)
+#ifndef _WIN32
+        , running_pid(0)
+#endif
+    {}
+
+    void run(PyThreadState* tstate);
+    static PyObject* thread_main(PyObject* module, PyObject* args);
+    static int report(void* arg);
+    static void stop();
+
+public:
+    // Never deleted: the thread may still be winding down when
+    // the process exits.
+    static BlockingWatchdog& instance()
+    {
+        static BlockingWatchdog* const the_watchdog = new BlockingWatchdog;
+        return *the_watchdog;
+    }
+
+    void watch(BlockingWatch* watch);
+    void unwatch(BlockingWatch* watch) noexcept;
+};
+
+void BlockingWatchdog::watch(BlockingWatch* watch)
+{
+    {
+        LockGuard guard(this->lock);
+#ifndef _WIN32
+        if (this->running && this->running_pid != getpid()) {
+            this->running = false;
+            this->needs_gil = false;
+        }
+#endif
+        this->watches.push_back(watch);
+        if (this->running) {
+            this->wakeup.notify_all();
+            return;
+        }
+        this->running = true;
+        this->needs_gil = true;
+#ifndef _WIN32
+        this->running_pid = getpid();
+#endif
+    }
+    // Starting the thread runs Python code, which may let other
+    // threads in, so not with the lock held.
+    static PyMethodDef thread_main_def = {
+        .ml_name="_blocking_watchdog",
+        .ml_meth=(PyCFunction)BlockingWatchdog::thread_main,
+        .ml_flags=METH_NOARGS,
+        .ml_doc=nullptr
+    };
+    try {
+        const OwnedObject thread_module = OwnedObject::consuming(
+            Require(PyImport_ImportModule("_thread")));
+        const OwnedObject func = OwnedObject::consuming(
+            Require(PyCFunction_New(&thread_main_def, nullptr)));
+        OwnedObject::consuming(
+            Require(PyObject_CallMethod(thread_module.borrow(), "start_new_thread", "OO",
+                                        func.borrow(), mod_globs->empty_tuple.borrow())));
+    }
+    catch (const PyErrOccurred&) {
+        LockGuard guard(this->lock);
+        const auto it = std::find(this->watches.begin(), this->watches.end(), watch);
+        if (it != this->watches.end()) {
+            this->watches.erase(it);
+        }
+        this->running = false;
+        this->needs_gil = false;
+        throw;
+    }
+    if (!this->stop_at_exit) {
+        // If this fails, the thread is simply left running.
+        this->stop_at_exit = Py_AtExit(BlockingWatchdog::stop) == 0;
+    }
+}
+
+PyObject* BlockingWatchdog::thread_main(PyObject* UNUSED(module), PyObject* UNUSED(args))
+{
+    PyThreadState* const tstate = PyEval_SaveThread();
+    BlockingWatchdog::instance().run(tstate);
+    PyEval_RestoreThread(tstate);
+    Py_RETURN_NONE;
+}
+
+void BlockingWatchdog::unwatch(BlockingWatch* watch) noexcept
+{
+    LockGuard guard(this->lock);
+    for (auto it = this->watches.begin(); it != this->watches.end(); ++it) {
+        if (*it == watch) {
+            this->watches.erase(it);
+            break;
+        }
+    }
+    this->wakeup.notify_all();
+}
+
+void BlockingWatchdog::run(PyThreadState* tstate)
+{
+    std::unique_lock<Mutex> guard(this->lock);
+    this->needs_gil = false;
+    while (!this->watches.empty() && !this->stopping) {
+        const int64_t now = SwitchStats::now_ns();
+        int64_t wait_ns = 1000000000;
+        bool overdue = false;
+        for (BlockingWatch* watch : this->watches) {
+            const int64_t last = watch->last_switch_ns.load(std::memory_order_relaxed);
+            const int64_t due = last + watch->threshold_ns;
+            if (now < due) {
+                wait_ns = std::min(wait_ns, due - now);
+            }
+            else {
+                // Only once for each time it's overdue; after that,
+                // just look again for it having switched.
+                if (last != watch->overdue_ns) {
+                    watch->overdue_ns = last;
+                    watch->report_pending = true;
+                    overdue = true;
+                }
+                wait_ns = std::min(wait_ns, watch->threshold_ns);
+            }
+        }
+        if (overdue && !this->report_scheduled) {
+            this->report_scheduled = true;
+            this->needs_gil = true;
+            guard.unlock();
+            // Like ThreadState_DestroyNoGIL::AddPendingCall, we
+            // can't do this once the interpreter is finalizing.
+            const bool scheduled = !greenlet::IsShuttingDown()
+                && Py_AddPendingCall(BlockingWatchdog::report, this) == 0;
+#if !GREENLET_PY313
+            // Before 3.13, adding a pending call from a thread other
+            // than the main thread doesn't tell the main thread to
+            // look for it; it notices when another thread asks it
+            // for the GIL. So ask. (If the GIL is being held by
+            // code that never lets go, this waits, but so would the
+            // report.) A thread that asks once finalizing has
+            // started never returns, so check again as late as we
+            // can.
+            if (scheduled && !greenlet::IsShuttingDown()) {
+                PyEval_RestoreThread(tstate);
+                PyEval_SaveThread();
+            }
+#else
+            (void)tstate;
+#endif
+            guard.lock();
+            this->needs_gil = false;
+            if (!scheduled) {
+                this->report_scheduled = false;
+            }
+        }
+        // Don't spin on very short thresholds.
+        this->wakeup.wait_for(guard,
+                              std::chrono::nanoseconds(std::max(wait_ns, (int64_t)1000000)));
+    }
+    this->running = false;
+    this->exited.notify_all();
+}
+
+int BlockingWatchdog::report(void* arg)
+{
+    BlockingWatchdog* const self = static_cast<BlockingWatchdog*>(arg);
+    struct Report {
+        OwnedObject callback;
+        OwnedGreenlet glet;
+        int64_t elapsed_ns;
+        unsigned long thread_ident;
+    };
+    std::vector<Report> reports;
+    try {
+        LockGuard guard(self->lock);
+        self->report_scheduled = false;
+        const int64_t now = SwitchStats::now_ns();
+        for (BlockingWatch* watch : self->watches) {
+            if (!watch->report_pending) {
+                continue;
+            }
+            watch->report_pending = false;
+            const int64_t last = watch->last_switch_ns.load(std::memory_order_relaxed);
+            // If it's switched since, the greenlet that was
+            // running may be gone; and if the thread has died, the
+            // cleanup is coming.
+            if (last != watch->overdue_ns
+                || watch->state->borrow_main_greenlet()->thread_state() != watch->state) {
+                continue;
+            }
+            // We hold the GIL, so the thread can't switch now.
+            reports.push_back(Report{watch->state->blocking_watchdog_callback(),
+                                     watch->state->get_current(),
+                                     now - last,
+                                     watch->thread_ident});
+        }
+    }
+    catch (const std::bad_alloc&) {
+        // Drop them.
+    }
+
+    PyErrPieces saved_exc;
+    for (const Report& report : reports) {
+        try {
+            // The frame the thread is running is the greenlet's.
+            // Turn it into a stack summary now, while it's still
+            // the one that's stuck.
+            OwnedObject stack = OwnedObject::None();
+            const OwnedObject frames = OwnedObject::consuming(
+                Require(PyObject_CallNoArgs(
+                            Require(PySys_GetObject("_current_frames"), "_current_frames"))));
+            const OwnedObject ident = OwnedObject::consuming(
+                Require(PyLong_FromUnsignedLong(report.thread_ident)));
+            if (PyObject* frame = PyDict_GetItem(frames.borrow(), ident.borrow())) {
+                const OwnedObject traceback = OwnedObject::consuming(
+                    Require(PyImport_ImportModule("traceback")));
+                stack = OwnedObject::consuming(
+                    Require(PyObject_CallMethod(traceback.borrow(), "extract_stack", "O", frame)));
+            }
+            OwnedObject::consuming(
+                Require(PyObject_CallFunction(report.callback.borrow(), "OdO",
+                                              report.glet.borrow_o(),
+                                              report.elapsed_ns / 1e9,
+                                              stack.borrow())));
+        }
+        catch (const PyErrOccurred&) {
+            PyErr_WriteUnraisable(report.callback.borrow());
+        }
+    }
+    saved_exc.PyErrRestore();
+    return 0;
+}
+
+void BlockingWatchdog::stop()
+{
+    // Called by Py_Finalize, after the interpreter is gone.
+    BlockingWatchdog& self = BlockingWatchdog::instance();
+    std::unique_lock<Mutex> guard(self.lock);
+#ifndef _WIN32
+    if (self.running_pid != getpid()) {
+        return;
+    }
+#endif
+    self.stopping = true;
+    self.wakeup.notify_all();
+    // If it was waiting for the GIL when finalizing started, it's
+    // gone, or never getting it.
+    self.exited.wait_for(guard, std::chrono::seconds(1),
+                         [&self] { return !self.running || self.needs_gil; });
+}
+
+BlockingWatch::BlockingWatch(const ThreadState* state, int64_t threshold_ns)
+    : state(state),
+      thread_ident(PyThread_get_thread_ident()),
+      threshold_ns(threshold_ns),
+      last_switch_ns(SwitchStats::now_ns()),
+      overdue_ns(0),
+      report_pending(false)
+{
+    BlockingWatchdog::instance().watch(this);
+}
+
+BlockingWatch::~BlockingWatch()
+{
+    BlockingWatchdog::instance().unwatch(this);
+}
+
+}; // namespace greenlet
+
+#endif
@@ -39,7 +39,7 @@ UserGreenlet::switchstack_result_t BrokenGreenlet::g_switchstack(void)
   if (this->_force_switch_error) {
     return switchstack_result_t(-1);
   }
-  return UserGreenlet::g_switchstack();
+  return this->g_switchstack_impl();
 }
 
 }; //namespace greenlet
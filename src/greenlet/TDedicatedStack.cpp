@@ -0,0 +1,338 @@
+#ifndef GREENLET_DEDICATED_STACK_CPP
+#define GREENLET_DEDICATED_STACK_CPP
+/**
+ * Implementation of greenlet::DedicatedStack and
+ * greenlet::DedicatedStackPool.
+ */
+#include "TGreenlet.hpp"
+
+#if GREENLET_USE_DEDICATED_STACKS
+#include <cerrno>
+#include <new>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace greenlet {
+
+static size_t
+dedicated_stack_page_size() noexcept
+{
+    static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return page_size;
+}
+
+DedicatedStack::DedicatedStack(char* base, size_t mapped_size, DedicatedStackPool* pool)
+    : base(base),
+      mapped_size(mapped_size),
+      pool(pool),
+      refcount(1),
+      _chain_head(nullptr),
+      prev(nullptr),
+      next(nullptr),
+      advised(false)
+{
+}
+
+DedicatedStack::~DedicatedStack()
+{
+}
+
+DedicatedStack*
+DedicatedStack::create(size_t mapped_size, DedicatedStackPool* pool) noexcept
+{
+    const size_t page_size = dedicated_stack_page_size();
+    void* base = mmap(nullptr, mapped_size,
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK,
+                      -1, 0);
+    if (base == MAP_FAILED) {
+        return nullptr;
+    }
+    if (mprotect(base, page_size, PROT_NONE)) {
+        munmap(base, mapped_size);
+        return nullptr;
+    }
+
+    // The header goes at the very top, aligned down far enough that
+    // the stack pointer (which starts just below it) satisfies any
+    // ABI's alignment requirements.
+    uintptr_t header = reinterpret_cast<uintptr_t>(base) + mapped_size - sizeof(DedicatedStack);
+    header &= ~uintptr_t(63);
+    return new (reinterpret_cast<void*>(header)) DedicatedStack(static_cast<char*>(base),
+                                                                mapped_size,
+                                                                pool);
+}
+
+void
+DedicatedStack::destroy() noexcept
+{
+    char* const base = this->base;
+    const size_t mapped_size = this->mapped_size;
+    this->~DedicatedStack();
+    munmap(base, mapped_size);
+}
+
+inline void
+DedicatedStack::decref() noexcept
+{
+    assert(this->refcount > 0);
+    if (--this->refcount == 0) {
+        this->pool->release(this);
+    }
+}
+
+
+#ifdef Py_GIL_DISABLED
+std::atomic<size_t> DedicatedStackPool::_limit(size_t(16) << 20);
+std::atomic<size_t> DedicatedStackPool::_resident_limit(size_t(4) << 20);
+#else
+size_t DedicatedStackPool::_limit = size_t(16) << 20;
+size_t DedicatedStackPool::_resident_limit = size_t(4) << 20;
+#endif
+
+DedicatedStackPool::DedicatedStackPool()
+    : free_list(nullptr),
+      in_use(nullptr),
+      _pooled_stacks(0),
+      _pooled_bytes(0),
+      _pooled_resident_bytes(0),
+      _in_use_stacks(0),
+      _in_use_bytes(0),
+      _hits(0),
+      _misses(0),
+      refcount(1),
+      orphaned(false)
+{
+}
+
+DedicatedStackPool::~DedicatedStackPool()
+{
+    assert(!this->free_list);
+    assert(!this->in_use);
+}
+
+DedicatedStackPool*
+DedicatedStackPool::create()
+{
+    return new (std::nothrow) DedicatedStackPool();
+}
+
+void
+DedicatedStackPool::decref() noexcept
+{
+    assert(this->refcount > 0);
+    if (--this->refcount == 0) {
+        delete this;
+    }
+}
+
+void
+DedicatedStackPool::orphan() noexcept
+{
+    this->trim();
+    this->orphaned = true;
+    this->decref();
+}
+
+inline size_t DedicatedStackPool::limit() noexcept
+{
+#ifdef Py_GIL_DISABLED
+    return DedicatedStackPool::_limit.load(std::memory_order_relaxed);
+#else
+    return DedicatedStackPool::_limit;
+#endif
+}
+
+inline void DedicatedStackPool::set_limit(size_t limit) noexcept
+{
+#ifdef Py_GIL_DISABLED
+    DedicatedStackPool::_limit.store(limit, std::memory_order_relaxed);
+#else
+    DedicatedStackPool::_limit = limit;
+#endif
+}
+
+inline size_t DedicatedStackPool::resident_limit() noexcept
+{
+#ifdef Py_GIL_DISABLED
+    return DedicatedStackPool::_resident_limit.load(std::memory_order_relaxed);
+#else
+    return DedicatedStackPool::_resident_limit;
+#endif
+}
+
+inline void DedicatedStackPool::set_resident_limit(size_t limit) noexcept
+{
+#ifdef Py_GIL_DISABLED
+    DedicatedStackPool::_resident_limit.store(limit, std::memory_order_relaxed);
+#else
+    DedicatedStackPool::_resident_limit = limit;
+#endif
+}
+
+DedicatedStack*
+DedicatedStackPool::acquire(size_t stack_size) noexcept
+{
+    const size_t page_size = dedicated_stack_page_size();
+    // One guard page, plus enough whole pages for the requested
+    // stack and the header above it.
+    const size_t wanted = stack_size + sizeof(DedicatedStack) + 64;
+    const size_t mapped_size = page_size + (wanted + page_size - 1) / page_size * page_size;
+
+    DedicatedStack* stack = nullptr;
+    for (DedicatedStack** link = &this->free_list; *link; link = &(*link)->next) {
+        if ((*link)->mapped_size == mapped_size) {
+            stack = *link;
+            *link = stack->next;
+            break;
+        }
+    }
+
+    if (stack) {
+        this->_pooled_stacks--;
+        this->_pooled_bytes -= mapped_size;
+        if (!stack->advised) {
+            this->_pooled_resident_bytes -= mapped_size;
+        }
+        this->_hits++;
+        stack->refcount = 1;
+        stack->_chain_head = nullptr;
+        stack->advised = false;
+    }
+    else {
+        this->_misses++;
+        stack = DedicatedStack::create(mapped_size, this);
+        if (!stack) {
+            return nullptr;
+        }
+    }
+
+    stack->prev = nullptr;
+    stack->next = this->in_use;
+    if (this->in_use) {
+        this->in_use->prev = stack;
+    }
+    this->in_use = stack;
+    this->_in_use_stacks++;
+    this->_in_use_bytes += mapped_size;
+    this->refcount++;
+    return stack;
+}
+
+void
+DedicatedStackPool::release(DedicatedStack* stack) noexcept
+{
+    const size_t mapped_size = stack->mapped_size;
+    if (stack->prev) {
+        stack->prev->next = stack->next;
+    }
+    else {
+        this->in_use = stack->next;
+    }
+    if (stack->next) {
+        stack->next->prev = stack->prev;
+    }
+    this->_in_use_stacks--;
+    this->_in_use_bytes -= mapped_size;
+
+    if (this->orphaned
+        || this->_pooled_bytes + mapped_size > DedicatedStackPool::limit()) {
+        this->unmap(stack);
+    }
+    else {
+        stack->prev = nullptr;
+        stack->next = this->free_list;
+        this->free_list = stack;
+        this->_pooled_stacks++;
+        this->_pooled_bytes += mapped_size;
+        if (this->_pooled_resident_bytes + mapped_size > DedicatedStackPool::resident_limit()) {
+            this->advise(stack);
+        }
+        else {
+            this->_pooled_resident_bytes += mapped_size;
+        }
+    }
+    // The stack's reference to us.
+    this->decref();
+}
+
+void
+DedicatedStackPool::unmap(DedicatedStack* stack) noexcept
+{
+    stack->destroy();
+}
+
+void
+DedicatedStackPool::advise(DedicatedStack* stack) noexcept
+{
+    // Everything between the guard page and the page holding the
+    // header. The contents don't matter the next time the stack is
+    // used, so we'll take zero-filled pages, or the old ones if
+    // the kernel hasn't gotten around to reclaiming them.
+    const size_t page_size = dedicated_stack_page_size();
+    char* const start = stack->base + page_size;
+    char* const end = reinterpret_cast<char*>(
+        reinterpret_cast<uintptr_t>(stack->top()) & ~uintptr_t(page_size - 1));
+    if (end <= start) {
+        return;
+    }
+#ifdef MADV_FREE
+    if (madvise(start, end - start, MADV_FREE) == 0) {
+        stack->advised = true;
+        return;
+    }
+    // Older kernels don't know MADV_FREE.
+#endif
+    if (madvise(start, end - start, MADV_DONTNEED) == 0) {
+        stack->advised = true;
+    }
+}
+
+size_t
+DedicatedStackPool::trim(size_t keep) noexcept
+{
+    size_t unmapped = 0;
+    while (this->free_list && this->_pooled_bytes > keep) {
+        DedicatedStack* const stack = this->free_list;
+        const size_t mapped_size = stack->mapped_size;
+        this->free_list = stack->next;
+        this->_pooled_stacks--;
+        this->_pooled_bytes -= mapped_size;
+        if (!stack->advised) {
+            this->_pooled_resident_bytes -= mapped_size;
+        }
+        this->unmap(stack);
+        unmapped += mapped_size;
+    }
+    return unmapped;
+}
+
+size_t
+DedicatedStackPool::resident_bytes() const noexcept
+{
+    const size_t page_size = dedicated_stack_page_size();
+    size_t resident = 0;
+    std::vector<unsigned char> pages;
+    const DedicatedStack* const lists[] = {this->in_use, this->free_list};
+    for (const DedicatedStack* stack : lists) {
+        for (; stack; stack = stack->next) {
+            const size_t npages = stack->mapped_size / page_size;
+            pages.resize(npages);
+            if (mincore(stack->base, stack->mapped_size, pages.data())) {
+                continue;
+            }
+            for (unsigned char page : pages) {
+                if (page & 1) {
+                    resident += page_size;
+                }
+            }
+        }
+    }
+    return resident;
+}
+
+}; // namespace greenlet
+
+#endif // GREENLET_USE_DEDICATED_STACKS
+#endif // GREENLET_DEDICATED_STACK_CPP
@@ -13,6 +13,7 @@
 #define TGREENLET_CPP
 #include "greenlet_internal.hpp"
 #include "TGreenlet.hpp"
+#include "greenlet_usdt.hpp"
 
 
 #include "TGreenletGlobals.cpp"
@@ -20,13 +21,15 @@
 
 namespace greenlet {
 
-Greenlet::Greenlet(PyGreenlet* p)
-    :  Greenlet(p, StackState())
+Greenlet::Greenlet(PyGreenlet* p, Kind kind)
+    :  Greenlet(p, StackState(), kind)
 {
 }
 
-Greenlet::Greenlet(PyGreenlet* p, const StackState& initial_stack)
-    :  _self(p), stack_state(initial_stack)
+Greenlet::Greenlet(PyGreenlet* p, const StackState& initial_stack, Kind kind)
+    :  _self(p), _kind(kind), _frames_always_exposed(false),
+       _run_ns(0), _resume_count(0), _last_resumed_ns(0),
+       stack_state(initial_stack)
 {
     assert(p->pimpl == nullptr);
     p->pimpl = this;
@@ -40,12 +43,6 @@ Greenlet::~Greenlet()
     this->_self->pimpl = nullptr;
 }
 
-bool
-Greenlet::force_slp_switch_error() const noexcept
-{
-    return false;
-}
-
 void
 Greenlet::release_args()
 {
@@ -74,8 +71,11 @@ Greenlet::slp_restore_state() noexcept
 #ifdef SLP_BEFORE_RESTORE_STATE
     SLP_BEFORE_RESTORE_STATE();
 #endif
+    ThreadState* const thread_state = this->thread_state();
     this->stack_state.copy_heap_to_stack(
-           this->thread_state()->borrow_current()->stack_state);
+           thread_state->borrow_current()->stack_state,
+           thread_state->stack_copy_pool(),
+           thread_state->thread_stack_chain_head());
 }
 
 
@@ -89,8 +89,11 @@ Greenlet::slp_save_state(char *const stackref) noexcept
 #ifdef SLP_BEFORE_SAVE_STATE
     SLP_BEFORE_SAVE_STATE();
 #endif
+    ThreadState* const thread_state = this->thread_state();
     return this->stack_state.copy_stack_to_heap(stackref,
-                                                this->thread_state()->borrow_current()->stack_state);
+                                                thread_state->borrow_current()->stack_state,
+                                                thread_state->stack_copy_pool(),
+                                                thread_state->thread_stack_chain_head());
 }
 
 /**
@@ -127,23 +130,45 @@ Greenlet::on_switchstack_or_initialstub_failure(
 }
 
 OwnedGreenlet
-Greenlet::g_switchstack_success() noexcept
+GREENLET_NOINLINE(Greenlet::g_switchstack_success)() noexcept
 {
+    // The thread state hasn't been changed yet.
+    ThreadState* thread_state = this->thread_state();
+    if (SwitchStats* const stats = thread_state->switch_stats()) {
+        stats->switched();
+    }
     PyThreadState* tstate = PyThreadState_GET();
     // restore the saved state
     this->python_state >> tstate;
     this->exception_state >> tstate;
 
-    // The thread state hasn't been changed yet.
-    ThreadState* thread_state = this->thread_state();
     OwnedGreenlet result(thread_state->get_current());
     thread_state->set_current(this->self());
+    if (thread_state->accounting_enabled()) {
+        const int64_t now = SwitchStats::now_ns();
+        result->_run_ns += thread_state->account_switch(now);
+        ++this->_resume_count;
+        this->_last_resumed_ns = now;
+    }
+    if (BlockingWatch* const watch = thread_state->blocking_watch()) {
+        watch->switched();
+    }
+    thread_state->record_switch(this->args() ? PyGreenlet_TRACE_SWITCH : PyGreenlet_TRACE_THROW,
+                                result.borrow(),
+                                this->self().borrow(),
+                                result->stack_saved());
+    // If we got here because the origin finished, we're no longer
+    // running on the stack it was using, so that can go now.
+    result->stack_state.release_dedicated_stack_if_dead();
+    // With the switch done, see if the greenlets that have been
+    // waiting should give up some memory.
+    thread_state->stack_copy_pool().pack_if_needed();
     //assert(thread_state->borrow_current().borrow() == this->_self);
     return result;
 }
 
 Greenlet::switchstack_result_t
-Greenlet::g_switchstack(void)
+GREENLET_NOINLINE(Greenlet::g_switchstack_impl)(void)
 {
     // if any of these assertions fail, it's likely because we
     // switched away and tried to switch back to us. Early stages of
@@ -155,21 +180,28 @@ Greenlet::g_switchstack(void)
     // gevent it's possible without realizing it)
     assert(this->args() || PyErr_Occurred());
     { /* save state */
-        if (this->thread_state()->is_current(this->self())) {
+        ThreadState* const thread_state = this->thread_state();
+        if (thread_state->is_current(this->self())) {
             // Hmm, nothing to do.
             // TODO: Does this bypass trace events that are
             // important?
             return switchstack_result_t(0,
-                                        this, this->thread_state()->borrow_current());
+                                        this, thread_state->borrow_current());
         }
-        BorrowedGreenlet current = this->thread_state()->borrow_current();
+        BorrowedGreenlet current = thread_state->borrow_current();
         PyThreadState* tstate = PyThreadState_GET();
 
         current->python_state << tstate;
         current->exception_state << tstate;
         this->python_state.will_switch_from(tstate);
         switching_thread_state = this;
-        current->expose_frames();
+        if (current->frames_always_exposed() || current->frames_may_be_reached()) {
+            current->expose_frames();
+        }
+        if (SwitchStats* const stats = thread_state->switch_stats()) {
+            stats->switching();
+        }
+        GREENLET_PROBE3(switch_begin, current.borrow(), this->_self, this->stack_saved());
     }
     assert(this->args() || PyErr_Occurred());
     // If this is the first switch into a greenlet, this will
@@ -209,18 +241,41 @@ Greenlet::g_switchstack(void)
     // etc. It returns the origin greenlet because its convenient.
 
     OwnedGreenlet origin = greenlet_that_switched_in->g_switchstack_success();
+    GREENLET_PROBE3(switch_end,
+                    origin.borrow(),
+                    greenlet_that_switched_in->_self,
+                    origin->stack_saved());
     assert(greenlet_that_switched_in->args() || PyErr_Occurred());
     return switchstack_result_t(err, greenlet_that_switched_in, origin);
 }
 
 
+inline OwnedObject
+Greenlet::g_switch()
+{
+    return this->g_switch(GET_THREAD_STATE().state());
+}
+
 inline void
 Greenlet::check_switch_allowed() const
 {
-    // TODO: Make this take a parameter of the current greenlet,
-    // or current main greenlet, to make the check for
-    // cross-thread switching cheaper. Surely somewhere up the
-    // call stack we've already accessed the thread local variable.
+    this->check_switch_allowed(GET_THREAD_STATE().state());
+}
+
+inline void
+Greenlet::check_switch_allowed(const ThreadState& current_thread_state) const
+{
+    const BorrowedMainGreenlet main_greenlet_cur_thread = current_thread_state.borrow_main_greenlet();
+    // The common case. A started greenlet (including a main
+    // greenlet) holds a reference to its main greenlet, so that
+    // can't have been replaced by another thread's, and the running
+    // thread's main greenlet belongs to a live thread.
+    if (this->started() && this->main_greenlet() == main_greenlet_cur_thread) {
+        return;
+    }
+
+    // Otherwise, find out what's wrong, or walk up the parents of a
+    // greenlet that hasn't started.
 
     // We expect to always have a main greenlet now; accessing the thread state
     // created it. However, if we get here and cleanup has already
@@ -255,7 +310,6 @@ Greenlet::check_switch_allowed() const
     // may not be visible yet. So we need to check against the
     // current thread state (once the cheaper checks are out of
     // the way)
-    const BorrowedMainGreenlet main_greenlet_cur_thread = GET_THREAD_STATE().state().borrow_main_greenlet();
     if (
         // lineage main greenlet is not this thread's greenlet
         main_greenlet_cur_thread != my_main_greenlet
@@ -347,10 +401,11 @@ Greenlet::context(BorrowedObject given)
  * Figure out what the result of ``greenlet.switch(arg, kwargs)``
  * should be and transfers ownership of it to the left-hand-side.
  *
- * If switch() was just passed an arg tuple, then we'll just return that.
- * If only keyword arguments were passed, then we'll pass the keyword
- * argument dict. Otherwise, we'll create a tuple of (args, kwargs) and
- * return both.
+ * If switch() was given a single value, that's the result. Otherwise,
+ * if it was just passed an arg tuple, then we'll return that, or its
+ * only item if it has just one. If only keyword arguments were passed,
+ * then we'll pass the keyword argument dict. Otherwise, we'll create a
+ * tuple of (args, kwargs) and return both.
  *
  * CAUTION: This may allocate a new tuple object, which may
  * cause the Python garbage collector to run, which in turn may
@@ -364,16 +419,20 @@ OwnedObject& operator<<=(OwnedObject& lhs, greenlet::SwitchingArgs& rhs) noexcep
     assert(rhs);
     OwnedObject args = rhs.args();
     OwnedObject kwargs = rhs.kwargs();
+    const bool single = rhs.single();
     rhs.CLEAR();
     // We shouldn't be called twice for the same switch.
     assert(args || kwargs);
     assert(!rhs);
 
-    if (!kwargs) {
+    if (single) {
         lhs = args;
     }
+    else if (!kwargs) {
+        lhs = greenlet::single_result(args);
+    }
     else if (!PyDict_Size(kwargs.borrow())) {
-        lhs = args;
+        lhs = greenlet::single_result(args);
     }
     else if (!PySequence_Length(args.borrow())) {
         lhs = kwargs;
@@ -403,15 +462,10 @@ g_handle_exit(const OwnedObject& greenlet_result)
         return OwnedObject(val);
     }
 
-    if (greenlet_result) {
-        // package the result into a 1-tuple
-        // PyTuple_Pack increments the reference of its arguments,
-        // so we always need to decref the greenlet result;
-        // the owner will do that.
-        return OwnedObject::consuming(PyTuple_Pack(1, greenlet_result.borrow()));
-    }
-
-    return OwnedObject();
+    // The result is handed to the parent as a single value (see
+    // SwitchingArgs), so there's no need to package it into a
+    // 1-tuple.
+    return greenlet_result;
 }
 
 
@@ -441,14 +495,20 @@ Greenlet::g_switch_finish(const switchstack_result_t& err)
         // Our only caller handles the bad error case
         assert(err.status >= 0);
         assert(state.borrow_current() == this->self());
-        if (OwnedObject tracefunc = state.get_tracefunc()) {
+        state.call_trace_hook(result ? PyGreenlet_TRACE_SWITCH : PyGreenlet_TRACE_THROW,
+                              err.origin_greenlet.borrow(),
+                              this->self().borrow());
+        if (OwnedObject tracefunc = state.get_tracefunc(
+                result ? ThreadState::TRACE_SWITCH : ThreadState::TRACE_THROW)) {
             assert(result || PyErr_Occurred());
-            g_calltrace(tracefunc,
+            g_calltrace(state,
+                        tracefunc,
                         result ? mod_globs->event_switch : mod_globs->event_throw,
                         err.origin_greenlet,
                         this->self());
         }
-        // The above could have invoked arbitrary Python code, but
+        state.check_saved_stack_budget();
+        // Both of the above could have invoked arbitrary Python code, but
         // it couldn't switch back to this object and *also*
         // throw an exception, so the args won't have changed.
 
@@ -471,7 +531,8 @@ Greenlet::g_switch_finish(const switchstack_result_t& err)
 }
 
 void
-Greenlet::g_calltrace(const OwnedObject& tracefunc,
+Greenlet::g_calltrace(ThreadState& thread_state,
+                      const OwnedObject& tracefunc,
                       const greenlet::refs::ImmortalEventName& event,
                       const BorrowedGreenlet& origin,
                       const BorrowedGreenlet& target)
@@ -488,7 +549,7 @@ Greenlet::g_calltrace(const OwnedObject& tracefunc,
         // In case of exceptions trace function is removed,
         // and any existing exception is replaced with the tracing
         // exception.
-        GET_THREAD_STATE().state().set_tracefunc(Py_None);
+        thread_state.set_tracefunc(Py_None);
         throw;
     }
 
@@ -496,6 +557,8 @@ Greenlet::g_calltrace(const OwnedObject& tracefunc,
     assert(
         (event == mod_globs->event_throw && PyErr_Occurred())
         || (event == mod_globs->event_switch && !PyErr_Occurred())
+        || (event == mod_globs->event_start && !PyErr_Occurred())
+        || event == mod_globs->event_finish
     );
 }
 
@@ -539,7 +602,10 @@ Greenlet::belongs_to_thread(const ThreadState* thread_state) const
         || !thread_state) { // same, or there is no thread state.
         return false;
     }
-    return true;
+    // A main greenlet has a thread state only while its thread is
+    // alive; any other greenlet must also share that main greenlet.
+    return this->_kind == Kind::MAIN
+        || this->main_greenlet() == thread_state->borrow_main_greenlet();
 }
 
 
@@ -622,7 +688,7 @@ bool Greenlet::is_currently_running_in_some_thread() const
 #if GREENLET_PY312
 void GREENLET_NOINLINE(Greenlet::expose_frames)()
 {
-    if (!this->python_state.top_frame()) {
+    if (!this->python_state.top_frame() || this->python_state.frames_exposed()) {
         return;
     }
 
@@ -721,12 +787,50 @@ void GREENLET_NOINLINE(Greenlet::expose_frames)()
                &last_complete_iframe->previous, sizeof(void *));
         last_complete_iframe->previous = nullptr;
     }
+    this->python_state.set_frames_exposed();
+}
+
+bool
+Greenlet::frames_may_be_reached() const noexcept
+{
+    const PyFrameObject* const top_frame = this->python_state.top_frame().borrow();
+    if (!top_frame) {
+        return false;
+    }
+    // Every frame object that exists is owned by its interpreter
+    // frame (the reference we keep to the top one isn't counted
+    // separately). Anything more means somebody else has one of our
+    // frames, and could follow ``f_back`` into the entry frames on
+    // our C stack. Frames owned by a generator or coroutine can be
+    // had from the generator at any time. We're still running, so we
+    // can read our frames directly.
+    for (const _PyInterpreterFrame* iframe = top_frame->f_frame;
+         iframe && iframe != this->python_state.base_frame();
+         iframe = iframe->previous) {
+        if (_PyFrame_IsIncomplete(const_cast<_PyInterpreterFrame*>(iframe))) {
+            continue;
+        }
+        if (iframe->owner == FRAME_OWNED_BY_GENERATOR) {
+            return true;
+        }
+        const PyFrameObject* const frame = iframe->frame_obj;
+        if (frame && Py_REFCNT(frame) > 1) {
+            return true;
+        }
+    }
+    return false;
 }
 #else
 void Greenlet::expose_frames()
 {
 
 }
+
+bool
+Greenlet::frames_may_be_reached() const noexcept
+{
+    return false;
+}
 #endif
 
 }; // namespace greenlet
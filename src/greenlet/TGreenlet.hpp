@@ -50,9 +50,23 @@ using greenlet::refs::BorrowedGreenlet;
 #endif
 #endif
 
+// Whether greenlets can be given their own C stack (``stack_size=``).
+// This needs ``makecontext()`` to get onto the new stack, and an
+// interpreter that doesn't track the bounds of the thread's C stack
+// (3.14 started doing that, and would see a greenlet running anywhere
+// else as a stack overflow).
+#if defined(__linux__) && defined(__GLIBC__) && !GREENLET_PY314
+#    define GREENLET_USE_DEDICATED_STACKS 1
+#else
+#    define GREENLET_USE_DEDICATED_STACKS 0
+#endif
+
 // XXX: TODO: Work to remove all virtual functions
 // for speed of calling and size of objects (no vtable).
-// One pattern is the Curiously Recurring Template
+// One pattern is the Curiously Recurring Template.
+// The ones used when switching are already gone: Greenlet records
+// which concrete class it is (Greenlet::Kind) and calls the
+// implementation directly (see the end of this file).
 namespace greenlet
 {
     class ExceptionState
@@ -169,6 +183,17 @@ namespace greenlet
         // interpreter detail; they're not needed for introspection, but do
         // need to be present for the eval loop to work.
         void unexpose_frames();
+#if GREENLET_PY312
+        // Whether the frames are currently exposed. Greenlets that
+        // don't expose their frames every time they switch away
+        // (``gr_frames_always_exposed``) are exposed when somebody
+        // asks for ``gr_frame``, and it mustn't happen twice.
+        bool frames_were_exposed;
+        // The frame that was running when we started; our first
+        // frame's entry frame points back to it. Frames from there on
+        // belong to whoever started us. Null for main greenlets.
+        _PyInterpreterFrame* _base_frame;
+#endif
 
     public:
 
@@ -190,9 +215,638 @@ namespace greenlet
 
         void may_switch_away() noexcept;
         inline void will_switch_from(PyThreadState *const origin_tstate) noexcept;
+#if GREENLET_PY312
+        inline bool frames_exposed() const noexcept
+        {
+            return this->frames_were_exposed;
+        }
+        inline void set_frames_exposed() noexcept
+        {
+            this->frames_were_exposed = true;
+        }
+        inline const _PyInterpreterFrame* base_frame() const noexcept
+        {
+            return this->_base_frame;
+        }
+#endif
         void did_finish(PyThreadState* tstate) noexcept;
     };
 
+    class StackState;
+
+    /**
+     * A per-thread cache of the buffers that hold the saved portions
+     * of greenlet stacks.
+     *
+     * Without this, a ping-pong between two greenlets does a
+     * ``PyMem_Realloc`` and a ``PyMem_Free`` for every switch.
+     * Buffers are handed out in power-of-two size classes; released
+     * buffers go onto a free list for their class (threaded through
+     * the buffers themselves, so the pool never allocates anything
+     * of its own) until the total held by the pool would exceed the
+     * process-wide limit. Requests bigger than the largest class go
+     * straight to the allocator and are never pooled.
+     *
+     * The pool also keeps track of the stacks saved in those
+     * buffers, in the order they were saved. When they take too much
+     * memory, or have been saved for too long, the oldest are
+     * packed (see stack_copy::pack()); they're unpacked when their
+     * greenlet resumes. Both limits are process-wide, and off by
+     * default.
+     *
+     * Only the thread that owns the pool may use it, and it must be
+     * holding the GIL: the buffers come from ``PyMem_Malloc``, and
+     * so can be freed with ``PyMem_Free`` from anywhere.
+     */
+    class StackCopyPool
+    {
+    private:
+        friend class StackState;
+        G_NO_COPIES_OF_CLS(StackCopyPool);
+        struct FreeBuffer
+        {
+            FreeBuffer* next;
+        };
+        // 512 bytes is a little smaller than what a simple switch
+        // from Python code typically saves.
+        static const unsigned int SMALLEST_CLASS_SHIFT = 9;
+        static const unsigned int NUM_CLASSES = 12;
+
+        FreeBuffer* free_lists[NUM_CLASSES];
+        size_t _pooled_bytes;
+        size_t _pooled_buffers;
+        size_t _hits;
+        size_t _misses;
+        // Saved stacks that aren't packed, oldest first, and those
+        // that are, in no particular order. Linked through
+        // StackState::saved_prev and saved_next.
+        StackState* saved_head;
+        StackState* saved_tail;
+        StackState* packed_head;
+        size_t _saved_stacks;
+        size_t _saved_bytes;
+        size_t _packed_stacks;
+        size_t _packed_bytes;
+        size_t _packed_saved_bytes;
+        size_t _packs;
+        size_t _unpacks;
+        int64_t _unpack_ns;
+        // Everything ever copied between the stack and the saved
+        // stacks, for SwitchStats.
+        size_t _copied_to_heap;
+        size_t _copied_to_stack;
+#ifdef Py_GIL_DISABLED
+        static std::atomic<size_t> _limit;
+        static std::atomic<size_t> _packing_limit;
+        static std::atomic<int64_t> _packing_idle_ns;
+#else
+        static size_t _limit;
+        static size_t _packing_limit;
+        static int64_t _packing_idle_ns;
+#endif
+        static inline unsigned int size_class(size_t n, size_t& class_size) noexcept;
+        static inline int64_t now_ns() noexcept;
+        inline void track(StackState& state) noexcept;
+        inline void untrack(StackState& state) noexcept;
+        bool pack(StackState& state) noexcept;
+        inline void unpack(char* dest, const StackState& state) noexcept;
+    public:
+        /**
+         * The largest buffer the pool will keep: 1MiB.
+         */
+        static const size_t LARGEST_CLASS_SIZE = size_t(1) << (SMALLEST_CLASS_SHIFT + NUM_CLASSES - 1);
+
+        StackCopyPool();
+        /**
+         * Does *not* free the pooled buffers; by the time a thread
+         * state is destroyed, the allocator may be gone. Use trim()
+         * when it's known to be safe. Stacks that are still saved
+         * (by greenlets that will never run again) forget about the
+         * pool.
+         */
+        ~StackCopyPool();
+
+        /**
+         * Return a buffer of at least *n* bytes, storing its actual
+         * size in *capacity*. Returns null on failure, without
+         * setting a Python exception.
+         */
+        inline char* allocate(size_t n, size_t& capacity) noexcept;
+        /**
+         * Accept a buffer from allocate() (of exactly *capacity*
+         * bytes) back into the pool, or free it if the pool is full.
+         */
+        inline void release(char* buf, size_t capacity) noexcept;
+        /**
+         * Free pooled buffers, largest first, until no more than
+         * *keep* bytes remain. Returns the number of bytes freed.
+         */
+        size_t trim(size_t keep=0) noexcept;
+
+        inline size_t pooled_bytes() const noexcept
+        {
+            return this->_pooled_bytes;
+        }
+        inline size_t pooled_buffers() const noexcept
+        {
+            return this->_pooled_buffers;
+        }
+        /**
+         * How many calls to allocate() were satisfied from the pool.
+         */
+        inline size_t hits() const noexcept
+        {
+            return this->_hits;
+        }
+        /**
+         * How many calls to allocate() had to go to the allocator.
+         */
+        inline size_t misses() const noexcept
+        {
+            return this->_misses;
+        }
+
+        static inline size_t limit() noexcept;
+        static inline void set_limit(size_t limit) noexcept;
+
+        /**
+         * Pack the oldest saved stacks while the unpacked ones take
+         * more than packing_limit() bytes, or were saved more than
+         * packing_idle_ns() ago. Called after each switch.
+         */
+        inline void pack_if_needed() noexcept;
+
+        inline size_t saved_stacks() const noexcept
+        {
+            return this->_saved_stacks;
+        }
+        /**
+         * The memory used by all the saved stacks, packed or not.
+         */
+        inline size_t saved_memory() const noexcept
+        {
+            return this->_saved_bytes + this->_packed_bytes;
+        }
+        /**
+         * The total saved by the stacks that aren't packed.
+         */
+        inline size_t saved_bytes() const noexcept
+        {
+            return this->_saved_bytes;
+        }
+        inline size_t packed_stacks() const noexcept
+        {
+            return this->_packed_stacks;
+        }
+        /**
+         * The memory used by the packed stacks.
+         */
+        inline size_t packed_bytes() const noexcept
+        {
+            return this->_packed_bytes;
+        }
+        /**
+         * What the packed stacks would take unpacked.
+         */
+        inline size_t packed_saved_bytes() const noexcept
+        {
+            return this->_packed_saved_bytes;
+        }
+        inline size_t packs() const noexcept
+        {
+            return this->_packs;
+        }
+        inline size_t unpacks() const noexcept
+        {
+            return this->_unpacks;
+        }
+        /**
+         * The total time spent unpacking, in nanoseconds.
+         */
+        inline int64_t unpack_ns() const noexcept
+        {
+            return this->_unpack_ns;
+        }
+        /**
+         * The total number of bytes ever copied off the stack to save
+         * it, and back onto the stack to restore it.
+         */
+        inline size_t copied_to_heap() const noexcept
+        {
+            return this->_copied_to_heap;
+        }
+        inline size_t copied_to_stack() const noexcept
+        {
+            return this->_copied_to_stack;
+        }
+
+        /**
+         * Saved stacks are packed, oldest first, while the unpacked
+         * ones total more than this. The default, the largest
+         * size_t, means never.
+         */
+        static inline size_t packing_limit() noexcept;
+        static inline void set_packing_limit(size_t limit) noexcept;
+        /**
+         * Saved stacks are packed once they've been saved for this
+         * many nanoseconds. Negative, the default, means never.
+         */
+        static inline int64_t packing_idle_ns() noexcept;
+        static inline void set_packing_idle_ns(int64_t ns) noexcept;
+    };
+
+    /**
+     * What a thread keeps track of about its switches while asked to
+     * (see ThreadState::enable_switch_stats()): how many there were,
+     * how long the switch of stacks took, as a total and as a
+     * histogram, and how many bytes of stack were copied.
+     *
+     * The thread only has one of these while it's enabled; otherwise
+     * all a switch has to do is see that it doesn't.
+     */
+    class SwitchStats
+    {
+    public:
+        /**
+         * Bucket 0 of the histogram counts the switches that took
+         * under a nanosecond; bucket *i*, those that took at least
+         * 2**(i-1) but less than 2**i nanoseconds. The last bucket also
+         * gets anything longer (about nine minutes).
+         */
+        static const unsigned int NUM_BUCKETS = 40;
+    private:
+        size_t _switches;
+        int64_t _switch_ns;
+        int64_t _max_ns;
+        int64_t _started_ns;
+        size_t buckets[NUM_BUCKETS];
+        // What the pool had copied when we started.
+        const size_t copied_to_heap_base;
+        const size_t copied_to_stack_base;
+        const StackCopyPool& pool;
+
+        G_NO_COPIES_OF_CLS(SwitchStats);
+    public:
+        SwitchStats(const StackCopyPool& pool);
+
+        /**
+         * Nanoseconds from the steady clock.
+         */
+        static inline int64_t now_ns() noexcept;
+
+        /**
+         * Called just before switching stacks.
+         */
+        inline void switching() noexcept
+        {
+            this->_started_ns = SwitchStats::now_ns();
+        }
+        /**
+         * Called once the stack has been switched, in the greenlet
+         * that was switched to.
+         */
+        inline void switched() noexcept;
+
+        inline size_t switches() const noexcept
+        {
+            return this->_switches;
+        }
+        /**
+         * The total time spent switching stacks, in nanoseconds.
+         */
+        inline int64_t switch_ns() const noexcept
+        {
+            return this->_switch_ns;
+        }
+        inline int64_t max_ns() const noexcept
+        {
+            return this->_max_ns;
+        }
+        inline size_t bucket(unsigned int i) const noexcept
+        {
+            return this->buckets[i];
+        }
+        inline size_t copied_to_heap() const noexcept
+        {
+            return this->pool.copied_to_heap() - this->copied_to_heap_base;
+        }
+        inline size_t copied_to_stack() const noexcept
+        {
+            return this->pool.copied_to_stack() - this->copied_to_stack_base;
+        }
+    };
+
+    /**
+     * The most recent switches a thread has made, kept while asked to
+     * (see ThreadState::enable_switch_history()), so that when it
+     * wedges or crashes there's a record of what ran.
+     *
+     * The entries are allocated up front; recording a switch
+     * overwrites the oldest one in place.
+     */
+    class SwitchHistory
+    {
+    public:
+        struct Entry
+        {
+            int64_t ns;
+            // Only for identification; they may be gone.
+            const PyGreenlet* origin;
+            const PyGreenlet* target;
+            // PyGreenlet_TRACE_SWITCH or PyGreenlet_TRACE_THROW
+            int event;
+            // How much of the origin's stack was saved.
+            intptr_t saved;
+        };
+    private:
+        Entry* const entries;
+        const size_t capacity;
+        // How many switches have been recorded in total.
+        size_t recorded;
+
+        G_NO_COPIES_OF_CLS(SwitchHistory);
+    public:
+        /**
+         * Raises std::bad_alloc if the entries can't be allocated.
+         */
+        SwitchHistory(size_t capacity);
+        ~SwitchHistory();
+
+        inline void record(int event,
+                           const PyGreenlet* origin,
+                           const PyGreenlet* target,
+                           intptr_t saved) noexcept;
+
+        /**
+         * How many entries there are, up to the capacity.
+         */
+        inline size_t size() const noexcept
+        {
+            return this->recorded < this->capacity ? this->recorded : this->capacity;
+        }
+
+        /**
+         * The *i*th entry, oldest first.
+         */
+        inline const Entry& at(size_t i) const noexcept
+        {
+            assert(i < this->size());
+            return this->entries[(this->recorded - this->size() + i) % this->capacity];
+        }
+
+        /**
+         * Write the entries to the file descriptor *fd* as text.
+         * This doesn't allocate memory or use Python, so it can be
+         * called from a signal handler or fatal error hook.
+         */
+        void dump(int fd) const noexcept;
+    };
+
+    class ThreadState;
+
+    /**
+     * A thread being watched for greenlets that run too long without
+     * switching.
+     *
+     * The thread stamps the time of each switch here; the watchdog
+     * thread (see TBlockingWatchdog.cpp), which waits without the
+     * GIL, compares that to the threshold. When it's been exceeded,
+     * the watchdog asks the interpreter to call back with
+     * ``Py_AddPendingCall``, and that reports the greenlet if it
+     * still hasn't switched. Creating one registers it with the
+     * watchdog, starting that if need be; deleting it unregisters it.
+     */
+    class BlockingWatch
+    {
+    private:
+        G_NO_COPIES_OF_CLS(BlockingWatch);
+        friend class BlockingWatchdog;
+        const ThreadState* const state;
+        const unsigned long thread_ident;
+        const int64_t threshold_ns;
+        std::atomic<int64_t> last_switch_ns;
+        // These are only used with the watchdog's lock held: the
+        // last_switch_ns that's been found to be overdue, and
+        // whether it's waiting for the pending call to report it.
+        int64_t overdue_ns;
+        bool report_pending;
+    public:
+        // Call in the thread to watch, with the GIL. This can raise
+        // std::bad_alloc, or PyErrOccurred if the watchdog thread
+        // can't be started.
+        BlockingWatch(const ThreadState* state, int64_t threshold_ns);
+        ~BlockingWatch();
+
+        inline int64_t threshold() const noexcept
+        {
+            return this->threshold_ns;
+        }
+
+        /**
+         * Called when a switch in the thread is complete.
+         */
+        inline void switched() noexcept
+        {
+            this->last_switch_ns.store(SwitchStats::now_ns(), std::memory_order_relaxed);
+        }
+    };
+
+    class DedicatedStackPool;
+
+    /**
+     * A C stack of its own, mapped separately from the thread's stack,
+     * for greenlets created with a ``stack_size``.
+     *
+     * A greenlet on such a stack doesn't have to move anything out of
+     * the way when it's switched to from a different stack, because
+     * nothing else is using that memory: the switch is just changing
+     * the stack pointer. Greenlets started *from* a greenlet on a
+     * dedicated stack share it with their parent, using the usual
+     * copying scheme among themselves.
+     *
+     * The lowest page of the mapping is a guard page, so overflowing
+     * the stack crashes instead of silently corrupting memory. This
+     * object lives at the other end, above the top of the stack.
+     * It's reference counted by the StackState objects of the
+     * greenlets using it, and given back to the DedicatedStackPool it
+     * came from when the last of those is done with it.
+     */
+    class DedicatedStack
+    {
+    private:
+        friend class DedicatedStackPool;
+        G_NO_COPIES_OF_CLS(DedicatedStack);
+        char* const base;
+        const size_t mapped_size;
+        DedicatedStackPool* const pool;
+#ifdef Py_GIL_DISABLED
+        std::atomic<unsigned long> refcount;
+#else
+        unsigned long refcount;
+#endif
+        // When no greenlet on this stack is running, the one that
+        // owns the most recently used part of it. See
+        // StackState::copy_stack_to_heap().
+        StackState* _chain_head;
+        // Links in the pool's list of stacks in use, or (only
+        // ``next``) its free list.
+        DedicatedStack* prev;
+        DedicatedStack* next;
+        // Whether the pages have been given back to the kernel since
+        // the stack was last used.
+        bool advised;
+
+        DedicatedStack(char* base, size_t mapped_size, DedicatedStackPool* pool);
+        ~DedicatedStack();
+        /**
+         * Map a new stack with the given total size, holding one
+         * reference to it. Returns null with ``errno`` set on
+         * failure.
+         */
+        static DedicatedStack* create(size_t mapped_size, DedicatedStackPool* pool) noexcept;
+        void destroy() noexcept;
+    public:
+        /**
+         * Requests smaller than this are refused.
+         */
+        static const size_t MIN_SIZE = 64 * 1024;
+
+        inline void incref() noexcept
+        {
+            ++this->refcount;
+        }
+        inline void decref() noexcept;
+
+        /**
+         * The lowest address of the mapping; this is the guard page.
+         */
+        inline char* mapping() const noexcept
+        {
+            return this->base;
+        }
+
+        /**
+         * The highest address usable by the stack; it grows down
+         * from here.
+         */
+        inline char* top() const noexcept
+        {
+            return reinterpret_cast<char*>(const_cast<DedicatedStack*>(this));
+        }
+
+        inline StackState*& chain_head() noexcept
+        {
+            return this->_chain_head;
+        }
+    };
+
+    /**
+     * A per-thread cache of dedicated stacks.
+     *
+     * Mapping and unmapping a stack for every greenlet that wants one
+     * takes a few system calls and page faults each time; instead,
+     * stacks that are no longer used come back here, to be handed out
+     * again to greenlets asking for the same size. The pool holds at
+     * most a process-wide limit's worth of stacks (by mapped size);
+     * past a lower, resident, limit, the pages of the stacks it holds
+     * are returned to the kernel with ``madvise()``, keeping the
+     * address space but not the memory.
+     *
+     * The pool is owned by a ThreadState, and each stack it has handed
+     * out also holds a reference to it, so a stack that outlives its
+     * thread (because some greenlet on it was never finished) can
+     * still come back. Once the thread is gone, returned stacks are
+     * simply unmapped. Except for that, only the owning thread may use
+     * the pool, and it must be holding the GIL.
+     */
+    class DedicatedStackPool
+    {
+    private:
+        G_NO_COPIES_OF_CLS(DedicatedStackPool);
+        DedicatedStack* free_list;
+        DedicatedStack* in_use;
+        size_t _pooled_stacks;
+        size_t _pooled_bytes;
+        size_t _pooled_resident_bytes;
+        size_t _in_use_stacks;
+        size_t _in_use_bytes;
+        size_t _hits;
+        size_t _misses;
+        unsigned long refcount;
+        bool orphaned;
+#ifdef Py_GIL_DISABLED
+        static std::atomic<size_t> _limit;
+        static std::atomic<size_t> _resident_limit;
+#else
+        static size_t _limit;
+        static size_t _resident_limit;
+#endif
+        DedicatedStackPool();
+        ~DedicatedStackPool();
+        void decref() noexcept;
+        void unmap(DedicatedStack* stack) noexcept;
+        void advise(DedicatedStack* stack) noexcept;
+    public:
+        static DedicatedStackPool* create();
+        /**
+         * The pool's thread is gone. Unmap the free stacks and drop
+         * the thread's reference.
+         */
+        void orphan() noexcept;
+
+        /**
+         * Return a stack with at least *stack_size* usable bytes,
+         * holding a reference to it. Returns null with ``errno``
+         * set on failure.
+         */
+        DedicatedStack* acquire(size_t stack_size) noexcept;
+        /**
+         * Called when the last reference to *stack* is gone.
+         */
+        void release(DedicatedStack* stack) noexcept;
+        /**
+         * Unmap pooled stacks until no more than *keep* bytes remain.
+         * Returns the number of bytes unmapped.
+         */
+        size_t trim(size_t keep=0) noexcept;
+
+        inline size_t pooled_stacks() const noexcept
+        {
+            return this->_pooled_stacks;
+        }
+        inline size_t pooled_bytes() const noexcept
+        {
+            return this->_pooled_bytes;
+        }
+        inline size_t in_use_stacks() const noexcept
+        {
+            return this->_in_use_stacks;
+        }
+        inline size_t in_use_bytes() const noexcept
+        {
+            return this->_in_use_bytes;
+        }
+        inline size_t hits() const noexcept
+        {
+            return this->_hits;
+        }
+        inline size_t misses() const noexcept
+        {
+            return this->_misses;
+        }
+        /**
+         * How much of the memory of the stacks in use and in the pool
+         * is actually resident. This asks the kernel about every page,
+         * so it's not cheap.
+         */
+        size_t resident_bytes() const noexcept;
+
+        static inline size_t limit() noexcept;
+        static inline void set_limit(size_t limit) noexcept;
+        static inline size_t resident_limit() noexcept;
+        static inline void set_resident_limit(size_t limit) noexcept;
+    };
+
     class StackState
     {
         // By having only plain C (POD) members, no virtual functions
@@ -203,13 +857,48 @@ namespace greenlet
         // std::shared_ptr for reference counting just to keep this
         // object small)
     private:
+        friend class StackCopyPool;
         char* _stack_start;
         char* stack_stop;
         char* stack_copy;
         intptr_t _stack_saved;
         StackState* stack_prev;
-        inline int copy_stack_to_heap_up_to(const char* const stop) noexcept;
+        // The usable size of ``stack_copy``; this can be more than
+        // ``_stack_saved`` because it comes from a StackCopyPool, or
+        // because we kept it after restoring (in which case
+        // ``_stack_saved`` is 0 but ``stack_copy`` isn't null).
+        size_t stack_copy_capacity;
+        // The stack this state lives on, or null for the thread's
+        // own stack. We hold a reference to it.
+        DedicatedStack* dedicated_stack;
+        // While ``_stack_saved`` isn't 0, the pool keeping track of
+        // us (until its thread goes away), and our links in its
+        // lists.
+        StackCopyPool* saved_pool;
+        StackState* saved_prev;
+        StackState* saved_next;
+        // When we were saved, if the pool wanted to know.
+        int64_t saved_at;
+        // Whether ``stack_copy`` holds the output of
+        // stack_copy::pack(), which is ``stack_copy_capacity`` bytes
+        // long and came from ``PyMem_Malloc``.
+        bool packed;
+#ifdef Py_GIL_DISABLED
+        static std::atomic<size_t> _retention_limit;
+#else
+        static size_t _retention_limit;
+#endif
+        inline int copy_stack_to_heap_up_to(const char* const stop,
+                                            StackCopyPool& pool) noexcept;
         inline void free_stack_copy() noexcept;
+        inline void release_stack_copy(StackCopyPool& pool) noexcept;
+        // Replace a packed copy with an unpacked one big enough for
+        // *n* bytes.
+        inline int unpack_stack_copy(size_t n, StackCopyPool& pool) noexcept;
+        inline void set_dedicated_stack(DedicatedStack* stack) noexcept;
+        // Where the most recent owner of the stack we're on is
+        // remembered while something on a different stack is running.
+        inline StackState*& chain_head(StackState*& thread_stack_head) const noexcept;
 
     public:
         /**
@@ -224,8 +913,18 @@ namespace greenlet
         ~StackState();
         StackState(const StackState& other);
         StackState& operator=(const StackState& other);
-        inline void copy_heap_to_stack(const StackState& current) noexcept;
-        inline int copy_stack_to_heap(char* const stackref, const StackState& current) noexcept;
+        /**
+         * *thread_stack_head* is where the thread keeps track of
+         * what's on its own stack while greenlets on a dedicated
+         * stack are running.
+         */
+        inline void copy_heap_to_stack(const StackState& current,
+                                       StackCopyPool& pool,
+                                       StackState*& thread_stack_head) noexcept;
+        inline int copy_stack_to_heap(char* const stackref,
+                                      const StackState& current,
+                                      StackCopyPool& pool,
+                                      StackState*& thread_stack_head) noexcept;
         inline bool started() const noexcept;
         inline bool main() const noexcept;
         inline bool active() const noexcept;
@@ -234,6 +933,29 @@ namespace greenlet
         inline intptr_t stack_saved() const noexcept;
         inline char* stack_start() const noexcept;
         static inline StackState make_main() noexcept;
+#if GREENLET_USE_DEDICATED_STACKS
+        /**
+         * Called by a new greenlet that has just begun running at the
+         * top of *stack*. From now on it lives there, and the stack
+         * it started on (which it's never going back to) belongs to
+         * whatever was there before it. Steals the reference to
+         * *stack*.
+         */
+        inline void move_to_dedicated_stack(DedicatedStack* stack,
+                                            StackState*& thread_stack_head) noexcept;
+#endif
+        /**
+         * Once a greenlet has died, and we've switched off of its
+         * stack, it doesn't need its stack anymore.
+         */
+        inline void release_dedicated_stack_if_dead() noexcept;
+        /**
+         * Buffers no larger than this many bytes are kept by the
+         * greenlet when its stack is restored, ready for the next
+         * time it's saved. 0, the default, disables this.
+         */
+        static inline size_t retention_limit() noexcept;
+        static inline void set_retention_limit(size_t limit) noexcept;
 #ifdef GREENLET_USE_STDIO
         friend std::ostream& operator<<(std::ostream& os, const StackState& s);
 #endif
@@ -258,19 +980,36 @@ namespace greenlet
         // switch. PyErr_... must have been called already.
         OwnedObject _args;
         OwnedObject _kwargs;
+        // If true, ``_args`` isn't an args tuple but the one value
+        // being switched, which is delivered as it is; ``_kwargs``
+        // is NULL. This is how ``switch(value)`` and the return value
+        // of ``run`` get where they're going without a 1-tuple
+        // around them.
+        bool _single;
     public:
 
         SwitchingArgs()
+            : _single(false)
         {}
 
         SwitchingArgs(const OwnedObject& args, const OwnedObject& kwargs)
             : _args(args),
-              _kwargs(kwargs)
+              _kwargs(kwargs),
+              _single(false)
+        {}
+
+        /**
+         * Switch with exactly *value*.
+         */
+        explicit SwitchingArgs(const OwnedObject& value)
+            : _args(value),
+              _single(true)
         {}
 
         SwitchingArgs(const SwitchingArgs& other)
             : _args(other._args),
-              _kwargs(other._kwargs)
+              _kwargs(other._kwargs),
+              _single(other._single)
         {}
 
         const OwnedObject& args()
@@ -283,6 +1022,11 @@ namespace greenlet
             return this->_kwargs;
         }
 
+        bool single() const noexcept
+        {
+            return this->_single;
+        }
+
         /**
          * Moves ownership from the argument to this object.
          */
@@ -291,6 +1035,7 @@ namespace greenlet
             if (this != &other) {
                 this->_args = other._args;
                 this->_kwargs = other._kwargs;
+                this->_single = other._single;
                 other.CLEAR();
             }
             return *this;
@@ -298,25 +1043,31 @@ namespace greenlet
 
         /**
          * Acquires ownership of the argument (consumes the reference).
+         *
+         * Sets the single value to switch with (if not NULL); clears
+         * the kwargs.
          */
-        SwitchingArgs& operator<<=(PyObject* args)
+        SwitchingArgs& operator<<=(PyObject* value)
         {
-            this->_args = OwnedObject::consuming(args);
+            this->_args = OwnedObject::consuming(value);
             this->_kwargs.CLEAR();
+            this->_single = value != nullptr;
             return *this;
         }
 
         /**
          * Acquires ownership of the argument.
          *
-         * Sets the args to be the given value; clears the kwargs.
+         * Sets the single value to switch with (if not NULL); clears
+         * the kwargs.
          */
-        SwitchingArgs& operator<<=(OwnedObject& args)
+        SwitchingArgs& operator<<=(OwnedObject& value)
         {
-            assert(&args != &this->_args);
-            this->_args = args;
+            assert(&value != &this->_args);
+            this->_args = value;
             this->_kwargs.CLEAR();
-            args.CLEAR();
+            this->_single = static_cast<bool>(value);
+            value.CLEAR();
 
             return *this;
         }
@@ -330,6 +1081,7 @@ namespace greenlet
         {
             this->_args.CLEAR();
             this->_kwargs.CLEAR();
+            this->_single = false;
         }
 
         const std::string as_str() const noexcept
@@ -346,8 +1098,6 @@ namespace greenlet
         }
     };
 
-    class ThreadState;
-
     class UserGreenlet;
     class MainGreenlet;
 
@@ -362,15 +1112,34 @@ namespace greenlet
         friend class UserGreenlet;
         friend class MainGreenlet;
     protected:
+        // The concrete class of this object. The functions that
+        // switching uses test this and call the right implementation
+        // directly, rather than being virtual.
+        enum class Kind : uint8_t {
+            USER,
+            BROKEN,
+            MAIN
+        };
+        const Kind _kind;
+        // Whether to expose our frames every time we switch away,
+        // or only when ``gr_frame`` is asked for.
+        bool _frames_always_exposed;
+        // How long we've run, how many times we've been switched
+        // into, and when we last were, all as accounted while the
+        // thread's accounting was enabled. Times are steady clock
+        // nanoseconds; ``_last_resumed_ns`` is 0 if we never were.
+        int64_t _run_ns;
+        uint64_t _resume_count;
+        int64_t _last_resumed_ns;
         ExceptionState exception_state;
         SwitchingArgs switch_args;
         StackState stack_state;
         PythonState python_state;
-        Greenlet(PyGreenlet* p, const StackState& initial_state);
+        Greenlet(PyGreenlet* p, const StackState& initial_state, Kind kind);
     public:
         // This constructor takes ownership of the PyGreenlet, by
         // setting ``p->pimpl = this;``.
-        Greenlet(PyGreenlet* p);
+        Greenlet(PyGreenlet* p, Kind kind);
         virtual ~Greenlet();
 
         const OwnedObject context() const;
@@ -394,7 +1163,7 @@ namespace greenlet
             return this->switch_args;
         }
 
-        virtual const refs::BorrowedMainGreenlet main_greenlet() const = 0;
+        inline const refs::BorrowedMainGreenlet main_greenlet() const;
 
         inline intptr_t stack_saved() const noexcept
         {
@@ -424,7 +1193,10 @@ namespace greenlet
          * because there are places where we can switch internally
          * without going through the Python method.
          */
-        virtual OwnedObject g_switch() = 0;
+        inline OwnedObject g_switch();
+        // As above, when the caller already has the state of the
+        // running thread.
+        inline OwnedObject g_switch(ThreadState& current_thread_state);
         /**
          * Force the greenlet to appear dead. Used when it's not
          * possible to throw an exception into a greenlet anymore.
@@ -463,13 +1235,44 @@ namespace greenlet
         // introspection purposes.
         void expose_frames();
 
+        // Could anything besides ``gr_frame`` get at our frames once
+        // we switch away? Called on the current greenlet as it
+        // switches away; if not, exposing them can wait until
+        // somebody asks for ``gr_frame``.
+        bool frames_may_be_reached() const noexcept;
+
+        inline bool frames_always_exposed() const noexcept
+        {
+            return this->_frames_always_exposed;
+        }
+        inline void frames_always_exposed(bool exposed) noexcept
+        {
+            this->_frames_always_exposed = exposed;
+        }
+
+        // The accounting kept by ``g_switchstack_success()`` when the
+        // thread has enabled it. The run time doesn't include the
+        // time since we were last resumed, if we're running now.
+        inline int64_t run_ns() const noexcept
+        {
+            return this->_run_ns;
+        }
+        inline uint64_t resume_count() const noexcept
+        {
+            return this->_resume_count;
+        }
+        inline int64_t last_resumed_ns() const noexcept
+        {
+            return this->_last_resumed_ns;
+        }
+
 
         // TODO: Figure out how to make these non-public.
         inline void slp_restore_state() noexcept;
         inline int slp_save_state(char *const stackref) noexcept;
 
         inline bool is_currently_running_in_some_thread() const;
-        virtual bool belongs_to_thread(const ThreadState* state) const;
+        bool belongs_to_thread(const ThreadState* state) const;
 
         inline bool started() const
         {
@@ -483,9 +1286,9 @@ namespace greenlet
         {
             return this->stack_state.main();
         }
-        virtual refs::BorrowedMainGreenlet find_main_greenlet_in_lineage() const = 0;
+        inline refs::BorrowedMainGreenlet find_main_greenlet_in_lineage() const;
 
-        virtual const OwnedGreenlet parent() const = 0;
+        inline const OwnedGreenlet parent() const;
         virtual void parent(const refs::BorrowedObject new_parent) = 0;
 
         inline const PythonState::OwnedFrame& top_frame()
@@ -496,6 +1299,11 @@ namespace greenlet
         virtual const OwnedObject& run() const = 0;
         virtual void run(const refs::BorrowedObject nrun) = 0;
 
+        // The size of the dedicated stack requested for this
+        // greenlet, or 0 if it runs on its thread's stack.
+        virtual size_t stack_size() const noexcept = 0;
+        virtual void stack_size(size_t nbytes) = 0;
+
 
         virtual int tp_traverse(visitproc visit, void* arg);
         virtual int tp_clear();
@@ -504,11 +1312,11 @@ namespace greenlet
         // Return the thread state that the greenlet is running in, or
         // null if the greenlet is not running or the thread is known
         // to have exited.
-        virtual ThreadState* thread_state() const noexcept = 0;
+        inline ThreadState* thread_state() const noexcept;
 
         // Return true if the greenlet is known to have been running
         // (active) in a thread that has now exited.
-        virtual bool was_running_in_dead_thread() const noexcept = 0;
+        inline bool was_running_in_dead_thread() const noexcept;
 
         // Return a borrowed greenlet that is the Python object
         // this object represents.
@@ -519,22 +1327,25 @@ namespace greenlet
 
         // For testing. If this returns true, we should pretend that
         // slp_switch() failed.
-        virtual bool force_slp_switch_error() const noexcept;
+        inline bool force_slp_switch_error() const noexcept;
 
         // Check the preconditions for switching to this greenlet; if they
         // aren't met, throws PyErrOccurred. Most callers will want to
         // catch this and clear the arguments if they've been set.
         inline void check_switch_allowed() const;
+        // As above, for a switch made by the running thread, whose
+        // state the caller already has. For a started greenlet, this
+        // is a single comparison.
+        inline void check_switch_allowed(const ThreadState& current_thread_state) const;
 
     protected:
         inline void release_args();
 
-        // The functions that must not be inlined are declared virtual.
-        // We also mark them as protected, not private, so that the
-        // compiler is forced to call them through a function pointer.
-        // (A sufficiently smart compiler could directly call a private
-        // virtual function since it can never be overridden in a
-        // subclass).
+        // The functions that must not be inlined are defined with
+        // GREENLET_NOINLINE. (They used to be virtual, and protected
+        // rather than private, to force the compiler to call them
+        // through a function pointer; that was an indirect call for
+        // every switch.)
 
         // Also TODO: Switch away from integer error codes and to enums,
         // or throw exceptions when possible.
@@ -590,7 +1401,7 @@ namespace greenlet
             const bool was_initial_stub=false);
 
         // Returns the previous greenlet we just switched away from.
-        virtual OwnedGreenlet g_switchstack_success() noexcept;
+        OwnedGreenlet g_switchstack_success() noexcept;
 
         class GreenletStartedWhileInPython : public std::runtime_error
         {
@@ -634,8 +1445,10 @@ namespace greenlet
            should no longer be the case with thread-local variables.)
 
         */
-        // Made virtual to facilitate subclassing UserGreenlet for testing.
-        virtual switchstack_result_t g_switchstack(void);
+        // BrokenGreenlet, for testing, can make this fail before it
+        // gets to the real work in g_switchstack_impl().
+        inline switchstack_result_t g_switchstack(void);
+        switchstack_result_t g_switchstack_impl(void);
 
 class TracingGuard
 {
@@ -686,7 +1499,8 @@ public:
 };
 
       static void
-      g_calltrace(const OwnedObject& tracefunc,
+      g_calltrace(ThreadState& thread_state,
+                  const OwnedObject& tracefunc,
                   const greenlet::refs::ImmortalEventName& event,
                   const greenlet::refs::BorrowedGreenlet& origin,
                   const BorrowedGreenlet& target);
@@ -702,6 +1516,7 @@ public:
         OwnedMainGreenlet _main_greenlet;
         OwnedObject _run_callable;
         OwnedGreenlet _parent;
+        size_t _stack_size;
     public:
         static void* operator new(size_t UNUSED(count));
         static void operator delete(void* ptr);
@@ -709,10 +1524,12 @@ public:
         UserGreenlet(PyGreenlet* p, BorrowedGreenlet the_parent);
         virtual ~UserGreenlet();
 
-        virtual refs::BorrowedMainGreenlet find_main_greenlet_in_lineage() const;
-        virtual bool was_running_in_dead_thread() const noexcept;
-        virtual ThreadState* thread_state() const noexcept;
-        virtual OwnedObject g_switch();
+        // These are called by the Greenlet functions of the same
+        // name, not through the vtable.
+        refs::BorrowedMainGreenlet find_main_greenlet_in_lineage() const;
+        bool was_running_in_dead_thread() const noexcept;
+        ThreadState* thread_state() const noexcept;
+        OwnedObject g_switch(ThreadState& current_thread_state);
         virtual const OwnedObject& run() const
         {
             if (this->started() || !this->_run_callable) {
@@ -722,13 +1539,18 @@ public:
         }
         virtual void run(const refs::BorrowedObject nrun);
 
-        virtual const OwnedGreenlet parent() const;
+        virtual size_t stack_size() const noexcept
+        {
+            return this->_stack_size;
+        }
+        virtual void stack_size(size_t nbytes);
+
+        const OwnedGreenlet parent() const;
         virtual void parent(const refs::BorrowedObject new_parent);
 
-        virtual const refs::BorrowedMainGreenlet main_greenlet() const;
+        const refs::BorrowedMainGreenlet main_greenlet() const;
 
         virtual void murder_in_place();
-        virtual bool belongs_to_thread(const ThreadState* state) const;
         virtual int tp_traverse(visitproc visit, void* arg);
         virtual int tp_clear();
         class ParentIsCurrentGuard
@@ -743,12 +1565,18 @@ public:
         };
         virtual OwnedObject throw_GreenletExit_during_dealloc(const ThreadState& current_thread_state);
     protected:
-        virtual switchstack_result_t g_initialstub(void* mark);
+        UserGreenlet(PyGreenlet* p, BorrowedGreenlet the_parent, Kind kind);
+        switchstack_result_t g_initialstub(void* mark, ThreadState& thread_state);
     private:
         // This function isn't meant to return.
         // This accepts raw pointers and the ownership of them at the
         // same time. The caller should use ``inner_bootstrap(origin.relinquish_ownership())``.
         void inner_bootstrap(PyGreenlet* origin_greenlet, PyObject* run);
+#if GREENLET_USE_DEDICATED_STACKS
+        // The entry point on a new dedicated stack; this finishes
+        // what g_initialstub() started and calls inner_bootstrap().
+        static void dedicated_stack_bootstrap();
+#endif
     };
 
     class BrokenGreenlet : public UserGreenlet
@@ -762,13 +1590,13 @@ public:
         static void* operator new(size_t UNUSED(count));
         static void operator delete(void* ptr);
         BrokenGreenlet(PyGreenlet* p, BorrowedGreenlet the_parent)
-            : UserGreenlet(p, the_parent)
+            : UserGreenlet(p, the_parent, Kind::BROKEN)
         {}
         virtual ~BrokenGreenlet()
         {}
 
-        virtual switchstack_result_t g_switchstack(void);
-        virtual bool force_slp_switch_error() const noexcept;
+        switchstack_result_t g_switchstack(void);
+        bool force_slp_switch_error() const noexcept;
 
     };
 
@@ -790,16 +1618,23 @@ public:
         virtual const OwnedObject& run() const;
         virtual void run(const refs::BorrowedObject nrun);
 
-        virtual const OwnedGreenlet parent() const;
+        virtual size_t stack_size() const noexcept
+        {
+            return 0;
+        }
+        virtual void stack_size(size_t nbytes);
+
+        // As for UserGreenlet, these aren't virtual.
+        const OwnedGreenlet parent() const;
         virtual void parent(const refs::BorrowedObject new_parent);
 
-        virtual const refs::BorrowedMainGreenlet main_greenlet() const;
+        const refs::BorrowedMainGreenlet main_greenlet() const;
 
-        virtual refs::BorrowedMainGreenlet find_main_greenlet_in_lineage() const;
-        virtual bool was_running_in_dead_thread() const noexcept;
-        virtual ThreadState* thread_state() const noexcept;
+        refs::BorrowedMainGreenlet find_main_greenlet_in_lineage() const;
+        bool was_running_in_dead_thread() const noexcept;
+        ThreadState* thread_state() const noexcept;
         void thread_state(ThreadState*) noexcept;
-        virtual OwnedObject g_switch();
+        OwnedObject g_switch(ThreadState& current_thread_state);
         virtual int tp_traverse(visitproc visit, void* arg);
     };
 
@@ -827,8 +1662,8 @@ public:
 
     OwnedObject& operator<<=(OwnedObject& lhs, greenlet::SwitchingArgs& rhs) noexcept;
 
-    //TODO: Greenlet::g_switch() should call this automatically on its
-    //return value. As it is, the module code is calling it.
+    // Greenlet::g_switch() calls this on its return value (through
+    // ``operator<<=`` above), unless the switch was with a single value.
     static inline OwnedObject
     single_result(const OwnedObject& results)
     {
@@ -853,6 +1688,73 @@ public:
         rhs.operator<<(lhs);
     }
 
+    // Dispatch to the concrete class. These are called on every
+    // switch, so they test ``_kind`` and make a direct call instead
+    // of going through the vtable. (BrokenGreenlet inherits everything
+    // but its testing hooks from UserGreenlet.)
+
+    inline OwnedObject Greenlet::g_switch(ThreadState& current_thread_state)
+    {
+        if (this->_kind == Kind::MAIN) {
+            return static_cast<MainGreenlet*>(this)->MainGreenlet::g_switch(current_thread_state);
+        }
+        return static_cast<UserGreenlet*>(this)->UserGreenlet::g_switch(current_thread_state);
+    }
+
+    inline Greenlet::switchstack_result_t Greenlet::g_switchstack()
+    {
+        if (this->_kind == Kind::BROKEN) {
+            return static_cast<BrokenGreenlet*>(this)->BrokenGreenlet::g_switchstack();
+        }
+        return this->g_switchstack_impl();
+    }
+
+    inline bool Greenlet::force_slp_switch_error() const noexcept
+    {
+        return this->_kind == Kind::BROKEN
+            && static_cast<const BrokenGreenlet*>(this)->BrokenGreenlet::force_slp_switch_error();
+    }
+
+    inline ThreadState* Greenlet::thread_state() const noexcept
+    {
+        if (this->_kind == Kind::MAIN) {
+            return static_cast<const MainGreenlet*>(this)->MainGreenlet::thread_state();
+        }
+        return static_cast<const UserGreenlet*>(this)->UserGreenlet::thread_state();
+    }
+
+    inline bool Greenlet::was_running_in_dead_thread() const noexcept
+    {
+        if (this->_kind == Kind::MAIN) {
+            return static_cast<const MainGreenlet*>(this)->MainGreenlet::was_running_in_dead_thread();
+        }
+        return static_cast<const UserGreenlet*>(this)->UserGreenlet::was_running_in_dead_thread();
+    }
+
+    inline const OwnedGreenlet Greenlet::parent() const
+    {
+        if (this->_kind == Kind::MAIN) {
+            return static_cast<const MainGreenlet*>(this)->MainGreenlet::parent();
+        }
+        return static_cast<const UserGreenlet*>(this)->UserGreenlet::parent();
+    }
+
+    inline const refs::BorrowedMainGreenlet Greenlet::main_greenlet() const
+    {
+        if (this->_kind == Kind::MAIN) {
+            return static_cast<const MainGreenlet*>(this)->MainGreenlet::main_greenlet();
+        }
+        return static_cast<const UserGreenlet*>(this)->UserGreenlet::main_greenlet();
+    }
+
+    inline refs::BorrowedMainGreenlet Greenlet::find_main_greenlet_in_lineage() const
+    {
+        if (this->_kind == Kind::MAIN) {
+            return static_cast<const MainGreenlet*>(this)->MainGreenlet::find_main_greenlet_in_lineage();
+        }
+        return static_cast<const UserGreenlet*>(this)->UserGreenlet::find_main_greenlet_in_lineage();
+    }
+
 } // namespace greenlet ;
 
 #endif
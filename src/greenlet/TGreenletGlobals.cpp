@@ -37,6 +37,8 @@ class GreenletGlobals
 public:
     const greenlet::refs::ImmortalEventName event_switch;
     const greenlet::refs::ImmortalEventName event_throw;
+    const greenlet::refs::ImmortalEventName event_start;
+    const greenlet::refs::ImmortalEventName event_finish;
     const greenlet::refs::ImmortalException PyExc_GreenletError;
     const greenlet::refs::ImmortalException PyExc_GreenletExit;
     const greenlet::refs::ImmortalObject empty_tuple;
@@ -48,6 +50,8 @@ public:
     GreenletGlobals() :
         event_switch("switch"),
         event_throw("throw"),
+        event_start("start"),
+        event_finish("finish"),
         PyExc_GreenletError("greenlet.error"),
         PyExc_GreenletExit("greenlet.GreenletExit", PyExc_BaseException),
         empty_tuple(Require(PyTuple_New(0))),
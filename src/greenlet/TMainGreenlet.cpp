@@ -44,7 +44,7 @@ void MainGreenlet::operator delete(void* ptr)
 
 
 MainGreenlet::MainGreenlet(PyGreenlet* p, ThreadState* state)
-    : Greenlet(p, StackState::make_main()),
+    : Greenlet(p, StackState::make_main(), Kind::MAIN),
       _self(p),
       _thread_state(state)
 {
@@ -92,10 +92,10 @@ MainGreenlet::was_running_in_dead_thread() const noexcept
 }
 
 OwnedObject
-MainGreenlet::g_switch()
+MainGreenlet::g_switch(ThreadState& current_thread_state)
 {
     try {
-        this->check_switch_allowed();
+        this->check_switch_allowed(current_thread_state);
     }
     catch (const PyErrOccurred&) {
         this->release_args();
@@ -143,6 +143,12 @@ MainGreenlet::run(const BorrowedObject UNUSED(nrun))
    throw AttributeError("Main greenlets do not have a run attribute.");
 }
 
+void
+MainGreenlet::stack_size(size_t UNUSED(nbytes))
+{
+    throw AttributeError("cannot set the stack size of a main greenlet");
+}
+
 void
 MainGreenlet::parent(const BorrowedObject raw_new_parent)
 {
@@ -37,6 +37,10 @@ PythonState::PythonState()
     ,datastack_top(nullptr)
     ,datastack_limit(nullptr)
 #endif
+#if GREENLET_PY312
+    ,frames_were_exposed(false)
+    ,_base_frame(nullptr)
+#endif
 {
 #if GREENLET_USE_CFRAME
     /*
@@ -93,6 +97,27 @@ PythonState::PythonState()
 }
 
 
+#if GREENLET_PY312
+/**
+ * Does the frame that ``PyThreadState_GetFrame()`` returns for
+ * *tstate* already have its frame object (or is there no such frame)?
+ * If so, calling it won't allocate anything.
+ */
+static inline bool
+top_frame_object_exists(const PyThreadState* tstate) noexcept
+{
+  #if GREENLET_PY313
+    _PyInterpreterFrame* iframe = tstate->current_frame;
+  #else
+    _PyInterpreterFrame* iframe = tstate->cframe->current_frame;
+  #endif
+    while (iframe && _PyFrame_IsIncomplete(iframe)) {
+        iframe = iframe->previous;
+    }
+    return !iframe || iframe->frame_obj;
+}
+#endif
+
 inline void PythonState::may_switch_away() noexcept
 {
 #if GREENLET_PY311
@@ -114,6 +139,15 @@ inline void PythonState::may_switch_away() noexcept
     // use ``_GetFrame()`` whenever we need to, just as it was in
     // <=3.10 (because subsequent calls will be cached and not
     // allocate memory).
+  #if GREENLET_PY312
+    // Most of the time, the frame object already exists: a loop that
+    // keeps switching from the same function only needs it made
+    // once. Then there's nothing to do, and no reason to touch the GC
+    // state. (On 3.11 we can't look inside the frame.)
+    if (top_frame_object_exists(PyThreadState_GET())) {
+        return;
+    }
+  #endif
 
     GCDisabledGuard no_gc;
     Py_XDECREF(PyThreadState_GetFrame(PyThreadState_GET()));
@@ -208,6 +242,10 @@ void PythonState::operator<<(const PyThreadState *const tstate) noexcept
 #if GREENLET_PY312
 void GREENLET_NOINLINE(PythonState::unexpose_frames)()
 {
+    if (!this->frames_were_exposed) {
+        return;
+    }
+    this->frames_were_exposed = false;
     if (!this->top_frame()) {
         return;
     }
@@ -328,6 +366,11 @@ inline void PythonState::will_switch_from(PyThreadState *const origin_tstate) no
 void PythonState::set_initial_state(const PyThreadState* const tstate) noexcept
 {
     this->_top_frame = nullptr;
+#if GREENLET_PY313
+    this->_base_frame = tstate->current_frame;
+#elif GREENLET_PY312
+    this->_base_frame = tstate->cframe->current_frame;
+#endif
 #if GREENLET_PY314
     this->py_recursion_depth = tstate->py_recursion_limit - tstate->py_recursion_remaining;
     this->current_executor = tstate->current_executor;
@@ -0,0 +1,328 @@
+#ifndef GREENLET_STACK_COPY_POOL_CPP
+#define GREENLET_STACK_COPY_POOL_CPP
+/**
+ * Implementation of greenlet::StackCopyPool.
+ */
+#include <chrono>
+
+#include "TGreenlet.hpp"
+#include "greenlet_stack_copy.hpp"
+
+namespace greenlet {
+
+#ifdef Py_GIL_DISABLED
+std::atomic<size_t> StackCopyPool::_limit(size_t(1) << 20);
+std::atomic<size_t> StackCopyPool::_packing_limit(std::numeric_limits<size_t>::max());
+std::atomic<int64_t> StackCopyPool::_packing_idle_ns(-1);
+#else
+size_t StackCopyPool::_limit = size_t(1) << 20;
+size_t StackCopyPool::_packing_limit = std::numeric_limits<size_t>::max();
+int64_t StackCopyPool::_packing_idle_ns = -1;
+#endif
+
+StackCopyPool::StackCopyPool()
+    : _pooled_bytes(0),
+      _pooled_buffers(0),
+      _hits(0),
+      _misses(0),
+      saved_head(nullptr),
+      saved_tail(nullptr),
+      packed_head(nullptr),
+      _saved_stacks(0),
+      _saved_bytes(0),
+      _packed_stacks(0),
+      _packed_bytes(0),
+      _packed_saved_bytes(0),
+      _packs(0),
+      _unpacks(0),
+      _unpack_ns(0),
+      _copied_to_heap(0),
+      _copied_to_stack(0)
+{
+    for (unsigned int i = 0; i < NUM_CLASSES; ++i) {
+        this->free_lists[i] = nullptr;
+    }
+}
+
+StackCopyPool::~StackCopyPool()
+{
+    StackState* lists[] = {this->saved_head, this->packed_head};
+    for (StackState* state : lists) {
+        while (state) {
+            StackState* const next = state->saved_next;
+            state->saved_pool = nullptr;
+            state->saved_prev = state->saved_next = nullptr;
+            state = next;
+        }
+    }
+}
+
+inline size_t StackCopyPool::limit() noexcept
+{
+#ifdef Py_GIL_DISABLED
+    return StackCopyPool::_limit.load(std::memory_order_relaxed);
+#else
+    return StackCopyPool::_limit;
+#endif
+}
+
+inline void StackCopyPool::set_limit(size_t limit) noexcept
+{
+#ifdef Py_GIL_DISABLED
+    StackCopyPool::_limit.store(limit, std::memory_order_relaxed);
+#else
+    StackCopyPool::_limit = limit;
+#endif
+}
+
+inline size_t StackCopyPool::packing_limit() noexcept
+{
+#ifdef Py_GIL_DISABLED
+    return StackCopyPool::_packing_limit.load(std::memory_order_relaxed);
+#else
+    return StackCopyPool::_packing_limit;
+#endif
+}
+
+inline void StackCopyPool::set_packing_limit(size_t limit) noexcept
+{
+#ifdef Py_GIL_DISABLED
+    StackCopyPool::_packing_limit.store(limit, std::memory_order_relaxed);
+#else
+    StackCopyPool::_packing_limit = limit;
+#endif
+}
+
+inline int64_t StackCopyPool::packing_idle_ns() noexcept
+{
+#ifdef Py_GIL_DISABLED
+    return StackCopyPool::_packing_idle_ns.load(std::memory_order_relaxed);
+#else
+    return StackCopyPool::_packing_idle_ns;
+#endif
+}
+
+inline void StackCopyPool::set_packing_idle_ns(int64_t ns) noexcept
+{
+#ifdef Py_GIL_DISABLED
+    StackCopyPool::_packing_idle_ns.store(ns, std::memory_order_relaxed);
+#else
+    StackCopyPool::_packing_idle_ns = ns;
+#endif
+}
+
+inline int64_t StackCopyPool::now_ns() noexcept
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline unsigned int
+StackCopyPool::size_class(size_t n, size_t& class_size) noexcept
+{
+    unsigned int cls = 0;
+    class_size = size_t(1) << SMALLEST_CLASS_SHIFT;
+    while (class_size < n) {
+        class_size <<= 1;
+        ++cls;
+    }
+    return cls;
+}
+
+inline char*
+StackCopyPool::allocate(size_t n, size_t& capacity) noexcept
+{
+    if (n > LARGEST_CLASS_SIZE) {
+        char* c = static_cast<char*>(PyMem_Malloc(n));
+        if (c) {
+            capacity = n;
+        }
+        ++this->_misses;
+        return c;
+    }
+
+    size_t class_size;
+    const unsigned int cls = size_class(n, class_size);
+    FreeBuffer* const b = this->free_lists[cls];
+    if (b) {
+        this->free_lists[cls] = b->next;
+        this->_pooled_bytes -= class_size;
+        --this->_pooled_buffers;
+        ++this->_hits;
+        capacity = class_size;
+        return reinterpret_cast<char*>(b);
+    }
+
+    ++this->_misses;
+    char* c = static_cast<char*>(PyMem_Malloc(class_size));
+    if (c) {
+        capacity = class_size;
+    }
+    return c;
+}
+
+inline void
+StackCopyPool::release(char* buf, size_t capacity) noexcept
+{
+    if (!buf) {
+        return;
+    }
+    if (capacity > LARGEST_CLASS_SIZE
+        || this->_pooled_bytes + capacity > StackCopyPool::limit()) {
+        PyMem_Free(buf);
+        return;
+    }
+    size_t class_size;
+    const unsigned int cls = size_class(capacity, class_size);
+    assert(class_size == capacity);
+    FreeBuffer* const b = reinterpret_cast<FreeBuffer*>(buf);
+    b->next = this->free_lists[cls];
+    this->free_lists[cls] = b;
+    this->_pooled_bytes += class_size;
+    ++this->_pooled_buffers;
+}
+
+size_t
+StackCopyPool::trim(size_t keep) noexcept
+{
+    size_t freed = 0;
+    for (unsigned int cls = NUM_CLASSES; cls > 0 && this->_pooled_bytes > keep; --cls) {
+        const size_t class_size = size_t(1) << (SMALLEST_CLASS_SHIFT + cls - 1);
+        while (this->free_lists[cls - 1] && this->_pooled_bytes > keep) {
+            FreeBuffer* const b = this->free_lists[cls - 1];
+            this->free_lists[cls - 1] = b->next;
+            PyMem_Free(b);
+            this->_pooled_bytes -= class_size;
+            --this->_pooled_buffers;
+            freed += class_size;
+        }
+    }
+    return freed;
+}
+
+inline void
+StackCopyPool::track(StackState& state) noexcept
+{
+    assert(!state.saved_pool);
+    assert(state._stack_saved > 0);
+    state.saved_pool = this;
+    if (state.packed) {
+        state.saved_prev = nullptr;
+        state.saved_next = this->packed_head;
+        if (this->packed_head) {
+            this->packed_head->saved_prev = &state;
+        }
+        this->packed_head = &state;
+        ++this->_packed_stacks;
+        this->_packed_bytes += state.stack_copy_capacity;
+        this->_packed_saved_bytes += state._stack_saved;
+        return;
+    }
+    state.saved_at = StackCopyPool::packing_idle_ns() >= 0
+        ? StackCopyPool::now_ns()
+        : 0;
+    state.saved_prev = this->saved_tail;
+    state.saved_next = nullptr;
+    if (this->saved_tail) {
+        this->saved_tail->saved_next = &state;
+    }
+    else {
+        this->saved_head = &state;
+    }
+    this->saved_tail = &state;
+    ++this->_saved_stacks;
+    this->_saved_bytes += state._stack_saved;
+}
+
+inline void
+StackCopyPool::untrack(StackState& state) noexcept
+{
+    assert(state.saved_pool == this);
+    if (state.saved_next) {
+        state.saved_next->saved_prev = state.saved_prev;
+    }
+    else if (!state.packed) {
+        this->saved_tail = state.saved_prev;
+    }
+    if (state.saved_prev) {
+        state.saved_prev->saved_next = state.saved_next;
+    }
+    else if (state.packed) {
+        this->packed_head = state.saved_next;
+    }
+    else {
+        this->saved_head = state.saved_next;
+    }
+    if (state.packed) {
+        --this->_packed_stacks;
+        this->_packed_bytes -= state.stack_copy_capacity;
+        this->_packed_saved_bytes -= state._stack_saved;
+    }
+    else {
+        --this->_saved_stacks;
+        this->_saved_bytes -= state._stack_saved;
+    }
+    state.saved_pool = nullptr;
+    state.saved_prev = state.saved_next = nullptr;
+}
+
+bool
+StackCopyPool::pack(StackState& state) noexcept
+{
+    assert(!state.packed);
+    const size_t n = state._stack_saved;
+    char* packed = static_cast<char*>(PyMem_Malloc(stack_copy::pack_bound(n)));
+    if (!packed) {
+        return false;
+    }
+    const size_t packed_size = stack_copy::pack(packed, state.stack_copy, n);
+    // Shrinking can't really fail, but if it does the bigger buffer
+    // is still good.
+    if (char* const shrunk = static_cast<char*>(PyMem_Realloc(packed, packed_size))) {
+        packed = shrunk;
+    }
+    this->untrack(state);
+    this->release(state.stack_copy, state.stack_copy_capacity);
+    state.stack_copy = packed;
+    state.stack_copy_capacity = packed_size;
+    state.packed = true;
+    this->track(state);
+    ++this->_packs;
+    return true;
+}
+
+inline void
+StackCopyPool::unpack(char* dest, const StackState& state) noexcept
+{
+    assert(state.packed);
+    const int64_t begin = StackCopyPool::now_ns();
+    stack_copy::unpack(dest, state.stack_copy, state._stack_saved, 0, state._stack_saved);
+    this->_unpack_ns += StackCopyPool::now_ns() - begin;
+    ++this->_unpacks;
+}
+
+inline void
+StackCopyPool::pack_if_needed() noexcept
+{
+    if (!this->saved_head) {
+        return;
+    }
+    const size_t limit = StackCopyPool::packing_limit();
+    const int64_t idle_ns = StackCopyPool::packing_idle_ns();
+    if (this->_saved_bytes <= limit && idle_ns < 0) {
+        return;
+    }
+    const int64_t now = idle_ns >= 0 ? StackCopyPool::now_ns() : 0;
+    while (this->saved_head
+           && (this->_saved_bytes > limit
+               || (idle_ns >= 0 && now - this->saved_head->saved_at > idle_ns))) {
+        if (!this->pack(*this->saved_head)) {
+            // Out of memory; maybe next time.
+            break;
+        }
+    }
+}
+
+}; // namespace greenlet
+
+#endif // GREENLET_STACK_COPY_POOL_CPP
@@ -2,6 +2,7 @@
 #define GREENLET_STACK_STATE_CPP
 
 #include "TGreenlet.hpp"
+#include "greenlet_stack_copy.hpp"
 
 namespace greenlet {
 
@@ -17,12 +18,21 @@ std::ostream& operator<<(std::ostream& os, const StackState& s)
        << ", stack_copy=" << (void*)s.stack_copy
        << ", stack_saved=" << s._stack_saved
        << ", stack_prev=" << s.stack_prev
+       << ", stack_copy_capacity=" << s.stack_copy_capacity
+       << ", dedicated_stack=" << (void*)s.dedicated_stack
+       << ", packed=" << s.packed
        << ", addr=" << &s
        << ")";
     return os;
 }
 #endif
 
+#ifdef Py_GIL_DISABLED
+std::atomic<size_t> StackState::_retention_limit(0);
+#else
+size_t StackState::_retention_limit = 0;
+#endif
+
 StackState::StackState(void* mark, StackState& current)
     : _stack_start(nullptr),
       stack_stop((char*)mark),
@@ -31,8 +41,17 @@ StackState::StackState(void* mark, StackState& current)
       /* Skip a dying greenlet */
       stack_prev(current._stack_start
                  ? &current
-                 : current.stack_prev)
+                 : current.stack_prev),
+      stack_copy_capacity(0),
+      dedicated_stack(nullptr),
+      saved_pool(nullptr),
+      saved_prev(nullptr),
+      saved_next(nullptr),
+      saved_at(0),
+      packed(false)
 {
+    // We begin life on the same stack as whatever started us.
+    this->set_dedicated_stack(current.dedicated_stack);
 }
 
 StackState::StackState()
@@ -40,7 +59,14 @@ StackState::StackState()
       stack_stop(nullptr),
       stack_copy(nullptr),
       _stack_saved(0),
-      stack_prev(nullptr)
+      stack_prev(nullptr),
+      stack_copy_capacity(0),
+      dedicated_stack(nullptr),
+      saved_pool(nullptr),
+      saved_prev(nullptr),
+      saved_next(nullptr),
+      saved_at(0),
+      packed(false)
 {
 }
 
@@ -51,7 +77,14 @@ StackState::StackState(const StackState& other)
       stack_stop(nullptr),
       stack_copy(nullptr),
       _stack_saved(0),
-      stack_prev(nullptr)
+      stack_prev(nullptr),
+      stack_copy_capacity(0),
+      dedicated_stack(nullptr),
+      saved_pool(nullptr),
+      saved_prev(nullptr),
+      saved_next(nullptr),
+      saved_at(0),
+      packed(false)
 {
     this->operator=(other);
 }
@@ -61,7 +94,7 @@ StackState& StackState::operator=(const StackState& other)
     if (&other == this) {
         return *this;
     }
-    if (other._stack_saved) {
+    if (other.stack_copy) {
         throw std::runtime_error("Refusing to steal memory.");
     }
 
@@ -73,27 +106,143 @@ StackState& StackState::operator=(const StackState& other)
     this->stack_copy = other.stack_copy;
     this->_stack_saved = other._stack_saved;
     this->stack_prev = other.stack_prev;
+    this->stack_copy_capacity = other.stack_copy_capacity;
+    this->set_dedicated_stack(other.dedicated_stack);
     return *this;
 }
 
+inline void StackState::set_dedicated_stack(DedicatedStack* stack) noexcept
+{
+#if GREENLET_USE_DEDICATED_STACKS
+    if (stack) {
+        stack->incref();
+    }
+    if (this->dedicated_stack) {
+        this->dedicated_stack->decref();
+    }
+    this->dedicated_stack = stack;
+#else
+    assert(!stack);
+    (void)stack;
+#endif
+}
+
+inline StackState*& StackState::chain_head(StackState*& thread_stack_head) const noexcept
+{
+    return this->dedicated_stack
+        ? this->dedicated_stack->chain_head()
+        : thread_stack_head;
+}
+
+#if GREENLET_USE_DEDICATED_STACKS
+inline void StackState::move_to_dedicated_stack(DedicatedStack* stack,
+                                                StackState*& thread_stack_head) noexcept
+{
+    // Nothing we left behind needs to be preserved; the rest of that
+    // stack is what the greenlet that started us was using.
+    this->chain_head(thread_stack_head) = this->stack_prev;
+    if (this->dedicated_stack) {
+        this->dedicated_stack->decref();
+    }
+    this->dedicated_stack = stack;
+    this->stack_stop = stack->top();
+    this->stack_prev = nullptr;
+}
+#endif
+
+inline void StackState::release_dedicated_stack_if_dead() noexcept
+{
+    if (this->dedicated_stack && !this->_stack_start) {
+        this->set_dedicated_stack(nullptr);
+    }
+}
+
 inline void StackState::free_stack_copy() noexcept
 {
+    if (this->saved_pool) {
+        this->saved_pool->untrack(*this);
+    }
     PyMem_Free(this->stack_copy);
     this->stack_copy = nullptr;
+    this->stack_copy_capacity = 0;
     this->_stack_saved = 0;
+    this->packed = false;
 }
 
-inline void StackState::copy_heap_to_stack(const StackState& current) noexcept
+inline void StackState::release_stack_copy(StackCopyPool& pool) noexcept
+{
+    if (this->saved_pool) {
+        this->saved_pool->untrack(*this);
+    }
+    if (this->packed) {
+        PyMem_Free(this->stack_copy);
+        this->packed = false;
+    }
+    else {
+        pool.release(this->stack_copy, this->stack_copy_capacity);
+    }
+    this->stack_copy = nullptr;
+    this->stack_copy_capacity = 0;
+    this->_stack_saved = 0;
+}
+
+inline int StackState::unpack_stack_copy(size_t n, StackCopyPool& pool) noexcept
+{
+    assert(this->packed);
+    assert(n >= (size_t)this->_stack_saved);
+    size_t capacity;
+    char* c = pool.allocate(n, capacity);
+    if (!c) {
+        return -1;
+    }
+    pool.unpack(c, *this);
+    if (this->saved_pool) {
+        this->saved_pool->untrack(*this);
+    }
+    PyMem_Free(this->stack_copy);
+    this->stack_copy = c;
+    this->stack_copy_capacity = capacity;
+    this->packed = false;
+    pool.track(*this);
+    return 0;
+}
+
+inline void StackState::copy_heap_to_stack(const StackState& current,
+                                           StackCopyPool& pool,
+                                           StackState*& thread_stack_head) noexcept
 {
 
     /* Restore the heap copy back into the C stack */
     if (this->_stack_saved != 0) {
-        memcpy(this->_stack_start, this->stack_copy, this->_stack_saved);
-        this->free_stack_copy();
+        pool._copied_to_stack += this->_stack_saved;
+        if (this->packed) {
+            pool.unpack(this->_stack_start, *this);
+            this->release_stack_copy(pool);
+        }
+        else if (this->stack_copy_capacity <= StackState::retention_limit()) {
+            memcpy(this->_stack_start, this->stack_copy, this->_stack_saved);
+            // Keep the buffer for the next time we're saved.
+            if (this->saved_pool) {
+                this->saved_pool->untrack(*this);
+            }
+            this->_stack_saved = 0;
+        }
+        else {
+            memcpy(this->_stack_start, this->stack_copy, this->_stack_saved);
+            this->release_stack_copy(pool);
+        }
     }
-    StackState* owner = const_cast<StackState*>(&current);
-    if (!owner->_stack_start) {
-        owner = owner->stack_prev; /* greenlet is dying, skip it */
+    StackState* owner;
+    if (this->dedicated_stack == current.dedicated_stack) {
+        owner = const_cast<StackState*>(&current);
+        if (!owner->_stack_start) {
+            owner = owner->stack_prev; /* greenlet is dying, skip it */
+        }
+    }
+    else {
+        // copy_stack_to_heap() already stepped over the current
+        // greenlet if it was dying.
+        owner = this->chain_head(thread_stack_head);
     }
     while (owner && owner->stack_stop <= this->stack_stop) {
         // cerr << "\tOwner: " << owner << endl;
@@ -103,7 +252,8 @@ inline void StackState::copy_heap_to_stack(const StackState& current) noexcept
     // cerr << "\tFinished with: " << *this << endl;
 }
 
-inline int StackState::copy_stack_to_heap_up_to(const char* const stop) noexcept
+inline int StackState::copy_stack_to_heap_up_to(const char* const stop,
+                                                 StackCopyPool& pool) noexcept
 {
     /* Save more of g's stack into the heap -- at least up to 'stop'
        g->stack_stop |________|
@@ -119,20 +269,41 @@ inline int StackState::copy_stack_to_heap_up_to(const char* const stop) noexcept
     intptr_t sz2 = stop - this->_stack_start;
     assert(this->_stack_start);
     if (sz2 > sz1) {
-        char* c = (char*)PyMem_Realloc(this->stack_copy, sz2);
-        if (!c) {
+        if (this->packed && this->unpack_stack_copy(sz2, pool)) {
             PyErr_NoMemory();
             return -1;
         }
-        memcpy(c + sz1, this->_stack_start + sz1, sz2 - sz1);
-        this->stack_copy = c;
+        if ((size_t)sz2 > this->stack_copy_capacity) {
+            size_t capacity;
+            char* c = pool.allocate(sz2, capacity);
+            if (!c) {
+                PyErr_NoMemory();
+                return -1;
+            }
+            if (sz1) {
+                memcpy(c, this->stack_copy, sz1);
+            }
+            pool.release(this->stack_copy, this->stack_copy_capacity);
+            this->stack_copy = c;
+            this->stack_copy_capacity = capacity;
+        }
+        memcpy(this->stack_copy + sz1, this->_stack_start + sz1, sz2 - sz1);
         this->_stack_saved = sz2;
+        pool._copied_to_heap += sz2 - sz1;
+        if (this->saved_pool) {
+            pool._saved_bytes += sz2 - sz1;
+        }
+        else {
+            pool.track(*this);
+        }
     }
     return 0;
 }
 
 inline int StackState::copy_stack_to_heap(char* const stackref,
-                                          const StackState& current) noexcept
+                                          const StackState& current,
+                                          StackCopyPool& pool,
+                                          StackState*& thread_stack_head) noexcept
 {
     /* must free all the C stack up to target_stop */
     const char* const target_stop = this->stack_stop;
@@ -146,15 +317,28 @@ inline int StackState::copy_stack_to_heap(char* const stackref,
         owner->_stack_start = stackref;
     }
 
-    while (owner->stack_stop < target_stop) {
+    if (this->dedicated_stack != current.dedicated_stack) {
+        // Switching between stacks. Nothing on the one we're leaving
+        // is in our way, so it can all stay there, but we need to
+        // remember who was using it. Whatever is in the way on the
+        // stack we're going to was left there by whoever was using
+        // it last.
+        current.chain_head(thread_stack_head) = owner;
+        owner = this->chain_head(thread_stack_head);
+    }
+
+    // On the thread's stack, the main greenlet stops the search; on a
+    // dedicated stack, the greenlet at the top of it does, unless
+    // that one has died.
+    while (owner && owner->stack_stop < target_stop) {
         /* ts_current is entierely within the area to free */
-        if (owner->copy_stack_to_heap_up_to(owner->stack_stop)) {
+        if (owner->copy_stack_to_heap_up_to(owner->stack_stop, pool)) {
             return -1; /* XXX */
         }
         owner = owner->stack_prev;
     }
-    if (owner != this) {
-        if (owner->copy_stack_to_heap_up_to(target_stop)) {
+    if (owner && owner != this) {
+        if (owner->copy_stack_to_heap_up_to(target_stop, pool)) {
             return -1; /* XXX */
         }
     }
@@ -195,7 +379,7 @@ inline void StackState::set_inactive() noexcept
     // Those objects never get deallocated, so the destructor never
     // runs.
     // It *seems* safe to clean up the memory here?
-    if (this->_stack_saved) {
+    if (this->stack_copy) {
         this->free_stack_copy();
     }
 }
@@ -221,9 +405,28 @@ inline StackState StackState::make_main() noexcept
 
 StackState::~StackState()
 {
-    if (this->_stack_saved != 0) {
+    if (this->stack_copy) {
         this->free_stack_copy();
     }
+    this->set_dedicated_stack(nullptr);
+}
+
+inline size_t StackState::retention_limit() noexcept
+{
+#ifdef Py_GIL_DISABLED
+    return StackState::_retention_limit.load(std::memory_order_relaxed);
+#else
+    return StackState::_retention_limit;
+#endif
+}
+
+inline void StackState::set_retention_limit(size_t limit) noexcept
+{
+#ifdef Py_GIL_DISABLED
+    StackState::_retention_limit.store(limit, std::memory_order_relaxed);
+#else
+    StackState::_retention_limit = limit;
+#endif
 }
 
 void StackState::copy_from_stack(void* vdest, const void* vsrc, size_t n) const
@@ -250,7 +453,13 @@ void StackState::copy_from_stack(void* vdest, const void* vsrc, size_t n) const
     // We know src >= _stack_start after the before-copy, and
     // src < _stack_start + _stack_saved due to the first if condition
     size_t nspilled = std::min<size_t>(n, this->_stack_start + this->_stack_saved - src);
-    memcpy(dest, this->stack_copy + (src - this->_stack_start), nspilled);
+    if (this->packed) {
+        stack_copy::unpack(dest, this->stack_copy, this->_stack_saved,
+                           src - this->_stack_start, nspilled);
+    }
+    else {
+        memcpy(dest, this->stack_copy + (src - this->_stack_start), nspilled);
+    }
     dest += nspilled;
     src += nspilled;
     n -= nspilled;
@@ -0,0 +1,149 @@
+#ifndef GREENLET_SWITCH_STATS_CPP
+#define GREENLET_SWITCH_STATS_CPP
+/**
+ * Implementation of greenlet::SwitchStats and greenlet::SwitchHistory.
+ */
+#include <chrono>
+#include <new>
+#ifdef _WIN32
+#    include <io.h>
+#else
+#    include <unistd.h>
+#endif
+
+#include "TGreenlet.hpp"
+
+namespace greenlet {
+
+SwitchStats::SwitchStats(const StackCopyPool& pool)
+    : _switches(0),
+      _switch_ns(0),
+      _max_ns(0),
+      _started_ns(0),
+      copied_to_heap_base(pool.copied_to_heap()),
+      copied_to_stack_base(pool.copied_to_stack()),
+      pool(pool)
+{
+    for (unsigned int i = 0; i < NUM_BUCKETS; ++i) {
+        this->buckets[i] = 0;
+    }
+}
+
+inline int64_t SwitchStats::now_ns() noexcept
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void SwitchStats::switched() noexcept
+{
+    const int64_t elapsed = SwitchStats::now_ns() - this->_started_ns;
+    ++this->_switches;
+    this->_switch_ns += elapsed;
+    if (elapsed > this->_max_ns) {
+        this->_max_ns = elapsed;
+    }
+    unsigned int bucket = 0;
+    for (int64_t n = elapsed; n > 0 && bucket < NUM_BUCKETS - 1; n >>= 1) {
+        ++bucket;
+    }
+    ++this->buckets[bucket];
+}
+
+SwitchHistory::SwitchHistory(size_t capacity)
+    : entries(new Entry[capacity]),
+      capacity(capacity),
+      recorded(0)
+{
+    assert(capacity > 0);
+}
+
+SwitchHistory::~SwitchHistory()
+{
+    delete[] this->entries;
+}
+
+inline void SwitchHistory::record(int event,
+                                  const PyGreenlet* origin,
+                                  const PyGreenlet* target,
+                                  intptr_t saved) noexcept
+{
+    Entry& entry = this->entries[this->recorded % this->capacity];
+    entry.ns = SwitchStats::now_ns();
+    entry.origin = origin;
+    entry.target = target;
+    entry.event = event;
+    entry.saved = saved;
+    ++this->recorded;
+}
+
+// Formatting for dump(), which can't use anything that might
+// allocate, such as stdio.
+static char*
+format_unsigned(char* p, uint64_t n, unsigned int base) noexcept
+{
+    char digits[24];
+    char* d = digits;
+    do {
+        *d++ = "0123456789abcdef"[n % base];
+        n /= base;
+    } while (n);
+    while (d != digits) {
+        *p++ = *--d;
+    }
+    return p;
+}
+
+static char*
+format_string(char* p, const char* s) noexcept
+{
+    while (*s) {
+        *p++ = *s++;
+    }
+    return p;
+}
+
+static void
+write_all(int fd, const char* buf, size_t len) noexcept
+{
+    while (len) {
+#ifdef _WIN32
+        const int n = _write(fd, buf, static_cast<unsigned int>(len));
+#else
+        const ssize_t n = write(fd, buf, len);
+#endif
+        if (n <= 0) {
+            return;
+        }
+        buf += n;
+        len -= static_cast<size_t>(n);
+    }
+}
+
+void SwitchHistory::dump(int fd) const noexcept
+{
+    char line[160];
+    char* p = format_string(line, "Greenlet switches of this thread, oldest first (");
+    p = format_unsigned(p, this->size(), 10);
+    p = format_string(p, " of ");
+    p = format_unsigned(p, this->recorded, 10);
+    p = format_string(p, "):\n");
+    write_all(fd, line, p - line);
+    for (size_t i = 0; i < this->size(); ++i) {
+        const Entry& entry = this->at(i);
+        p = format_string(line, "  ");
+        p = format_unsigned(p, static_cast<uint64_t>(entry.ns), 10);
+        p = format_string(p, entry.event == PyGreenlet_TRACE_THROW ? " throw 0x" : " switch 0x");
+        p = format_unsigned(p, reinterpret_cast<uintptr_t>(entry.origin), 16);
+        p = format_string(p, " -> 0x");
+        p = format_unsigned(p, reinterpret_cast<uintptr_t>(entry.target), 16);
+        p = format_string(p, " saved ");
+        p = format_unsigned(p, static_cast<uint64_t>(entry.saved), 10);
+        p = format_string(p, "\n");
+        write_all(fd, line, p - line);
+    }
+}
+
+}; // namespace greenlet
+
+#endif
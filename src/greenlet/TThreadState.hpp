@@ -3,6 +3,7 @@
 
 #include <cstdlib>
 #include <ctime>
+#include <limits>
 #include <stdexcept>
 #include <atomic>
 
@@ -27,6 +28,15 @@ using greenlet::refs::NewReference;
 
 
 namespace greenlet {
+
+/**
+ * The running thread's switch history, if it's keeping one; the same
+ * as ``ThreadState::switch_history()``. Unlike the thread state
+ * itself, this is constant-initialized and has no destructor, so
+ * reading it never runs any code, and a signal handler can use it.
+ */
+static thread_local const SwitchHistory* g_thread_switch_history GREENLET_TLS_INITIAL_EXEC = nullptr;
+
 /**
  * Thread-local state of greenlets.
  *
@@ -103,6 +113,29 @@ private:
     /* Strong reference to the trace function, if any. */
     OwnedObject tracefunc;
 
+    /* The events (a mask of TraceEvent) the trace function wants,
+       and how often: one in _trace_sample of them, either every
+       _trace_sample-th one (counting down _trace_countdown) or at
+       random (using _trace_random_state). */
+    unsigned int _trace_events;
+    unsigned int _trace_sample;
+    unsigned int _trace_countdown;
+    bool _trace_sample_randomly;
+    uint32_t _trace_random_state;
+
+    /* The C trace hook, if any, and its argument. */
+    PyGreenlet_TraceHook _trace_hook;
+    void* _trace_hook_arg;
+
+    /* Strong reference to the function called when the saved stacks
+       go over budget, if any. */
+    OwnedObject saved_stack_budget_callback;
+
+    /* Strong reference to the function called when a greenlet runs
+       too long without switching, if this thread is being watched
+       for that. */
+    OwnedObject blocking_callback;
+
     // Use std::allocator (malloc/free) instead of PythonAllocator
     // (PyMem_Malloc) for the deleteme list. During Py_FinalizeEx on
     // Python < 3.11, the PyObject_Malloc pool that holds ThreadState
@@ -129,6 +162,46 @@ private:
     void* exception_state;
 #endif
 
+    /* Buffers for saving the stacks of greenlets in this thread. */
+    StackCopyPool _stack_copy_pool;
+
+    /* When the saved stacks hold more than this many bytes, call
+       saved_stack_budget_callback; it's called again only after
+       they've gone back under. */
+    size_t _saved_stack_budget;
+    size_t _saved_stack_budget_calls;
+    bool _saved_stack_budget_armed;
+
+    /* While a greenlet on a dedicated stack is running, the greenlet
+       that was most recently using this thread's own stack. */
+    StackState* _thread_stack_chain_head;
+
+    /* Statistics about this thread's switches, if they've been
+       enabled. */
+    SwitchStats* _switch_stats;
+
+    /* The most recent switches in this thread, if they're being
+       kept. */
+    SwitchHistory* _switch_history;
+
+    /* Whether the time spent running is being accounted to this
+       thread's greenlets; if so, when the current greenlet was
+       resumed, and the totals since accounting was enabled. */
+    bool _accounting;
+    int64_t _resumed_ns;
+    int64_t _accounted_ns;
+    uint64_t _accounted_switches;
+
+    /* What the blocking watchdog looks at, if it's watching this
+       thread. */
+    BlockingWatch* _blocking_watch;
+
+#if GREENLET_USE_DEDICATED_STACKS
+    /* Stacks for greenlets created with a stack_size; created the
+       first time one is needed. */
+    DedicatedStackPool* _dedicated_stack_pool;
+#endif
+
 #ifdef Py_GIL_DISABLED
     static std::atomic<std::clock_t> _clocks_used_doing_gc;
 #else
@@ -158,6 +231,20 @@ private:
         return main;
     }
 
+    void call_saved_stack_budget_callback(size_t held)
+    {
+        ++this->_saved_stack_budget_calls;
+        // The callback may well change the budget, so hold on to
+        // it ourself.
+        const OwnedObject callback(this->saved_stack_budget_callback);
+        PyErrPieces saved_exc;
+        const OwnedObject nbytes = OwnedObject::consuming(PyLong_FromSize_t(held));
+        if (!nbytes || !callback.PyCall(nbytes.borrow())) {
+            PyErr_WriteUnraisable(callback.borrow());
+        }
+        saved_exc.PyErrRestore();
+    }
+
 
 public:
     // Allocate ThreadState with malloc/free rather than Python's
@@ -186,6 +273,29 @@ public:
     }
 
     ThreadState()
+        : _trace_events(TRACE_SWITCH | TRACE_THROW),
+          _trace_sample(1),
+          _trace_countdown(1),
+          _trace_sample_randomly(false),
+          // xorshift mustn't start at 0.
+          _trace_random_state(static_cast<uint32_t>(
+              reinterpret_cast<uintptr_t>(this) >> 4) | 1),
+          _trace_hook(nullptr),
+          _trace_hook_arg(nullptr),
+          _saved_stack_budget(std::numeric_limits<size_t>::max()),
+          _saved_stack_budget_calls(0),
+          _saved_stack_budget_armed(true),
+          _thread_stack_chain_head(nullptr),
+          _switch_stats(nullptr),
+          _switch_history(nullptr),
+          _accounting(false),
+          _resumed_ns(0),
+          _accounted_ns(0),
+          _accounted_switches(0),
+          _blocking_watch(nullptr)
+#if GREENLET_USE_DEDICATED_STACKS
+        , _dedicated_stack_pool(nullptr)
+#endif
     {
 
 #ifdef GREENLET_NEEDS_EXCEPTION_STATE_SAVED
@@ -233,6 +343,8 @@ public:
             Py_VISIT(current_greenlet.borrow_o());
         }
         Py_VISIT(tracefunc.borrow());
+        Py_VISIT(saved_stack_budget_callback.borrow());
+        Py_VISIT(blocking_callback.borrow());
         return 0;
     }
 
@@ -307,6 +419,237 @@ public:
         this->current_greenlet = target;
     }
 
+    /**
+     * The pool for saved stack buffers. Only to be used in this
+     * thread.
+     */
+    inline StackCopyPool& stack_copy_pool() noexcept
+    {
+        return this->_stack_copy_pool;
+    }
+
+    inline size_t saved_stack_budget() const noexcept
+    {
+        return this->_saved_stack_budget;
+    }
+
+    /**
+     * How many times the budget callback has been called.
+     */
+    inline size_t saved_stack_budget_calls() const noexcept
+    {
+        return this->_saved_stack_budget_calls;
+    }
+
+    /**
+     * Call *callback* (unless it's None) with the number of bytes
+     * held by saved stacks when that goes over *budget*.
+     */
+    inline void set_saved_stack_budget(size_t budget, BorrowedObject callback)
+    {
+        assert(callback);
+        this->_saved_stack_budget = budget;
+        this->_saved_stack_budget_armed = true;
+        if (callback == BorrowedObject(Py_None)) {
+            this->saved_stack_budget_callback.CLEAR();
+        }
+        else {
+            this->saved_stack_budget_callback = callback;
+        }
+    }
+
+    /**
+     * Called when a switch into a greenlet of this thread is
+     * complete. If the saved stacks have gone over the budget since
+     * they were last under it, call the callback.
+     *
+     * CAUTION: This may run arbitrary Python code, including
+     * switching. Errors from the callback are reported as
+     * unraisable; any pending exception is preserved.
+     */
+    inline void check_saved_stack_budget()
+    {
+        const size_t held = this->_stack_copy_pool.saved_memory();
+        if (held <= this->_saved_stack_budget) {
+            this->_saved_stack_budget_armed = true;
+            return;
+        }
+        if (this->_saved_stack_budget_armed && this->saved_stack_budget_callback) {
+            this->_saved_stack_budget_armed = false;
+            this->call_saved_stack_budget_callback(held);
+        }
+    }
+
+    inline StackState*& thread_stack_chain_head() noexcept
+    {
+        return this->_thread_stack_chain_head;
+    }
+
+    /**
+     * The statistics being kept about this thread's switches, or
+     * null if they're not.
+     */
+    inline SwitchStats* switch_stats() const noexcept
+    {
+        return this->_switch_stats;
+    }
+
+    /**
+     * Start keeping statistics about this thread's switches, from
+     * zero, or stop.
+     */
+    inline void enable_switch_stats(bool enabled)
+    {
+        delete this->_switch_stats;
+        this->_switch_stats = nullptr;
+        if (enabled) {
+            this->_switch_stats = new SwitchStats(this->_stack_copy_pool);
+        }
+    }
+
+    /**
+     * The record of this thread's most recent switches, or null if
+     * it's not being kept.
+     */
+    inline const SwitchHistory* switch_history() const noexcept
+    {
+        return this->_switch_history;
+    }
+
+    /**
+     * Start keeping a record of the *capacity* most recent switches
+     * in this thread, discarding what was already recorded; 0 stops.
+     */
+    inline void enable_switch_history(size_t capacity)
+    {
+        // Nobody may see the old one once we start deleting it,
+        // including a signal handler in this thread.
+        SwitchHistory* const old = this->_switch_history;
+        this->_switch_history = nullptr;
+        g_thread_switch_history = nullptr;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        delete old;
+        if (capacity) {
+            this->_switch_history = new SwitchHistory(capacity);
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+            g_thread_switch_history = this->_switch_history;
+        }
+    }
+
+    /**
+     * Called when a switch from *origin* to *target* is complete.
+     */
+    inline void record_switch(int event,
+                              const PyGreenlet* origin,
+                              const PyGreenlet* target,
+                              intptr_t saved) noexcept
+    {
+        if (this->_switch_history) {
+            this->_switch_history->record(event, origin, target, saved);
+        }
+    }
+
+    inline BlockingWatch* blocking_watch() const noexcept
+    {
+        return this->_blocking_watch;
+    }
+
+    inline const OwnedObject& blocking_watchdog_callback() const noexcept
+    {
+        return this->blocking_callback;
+    }
+
+    /**
+     * Have the watchdog call *callback* when a greenlet of this
+     * thread runs for more than *threshold_ns* without switching,
+     * replacing any earlier setting; None stops watching. Call this
+     * in the thread. Can raise what creating a BlockingWatch does.
+     */
+    inline void set_blocking_watchdog(int64_t threshold_ns, BorrowedObject callback)
+    {
+        assert(callback);
+        delete this->_blocking_watch;
+        this->_blocking_watch = nullptr;
+        this->blocking_callback.CLEAR();
+        if (callback != BorrowedObject(Py_None)) {
+            this->_blocking_watch = new BlockingWatch(this, threshold_ns);
+            this->blocking_callback = callback;
+        }
+    }
+
+    inline bool accounting_enabled() const noexcept
+    {
+        return this->_accounting;
+    }
+
+    /**
+     * Start accounting the time spent running to this thread's
+     * greenlets, with the thread totals from zero, or stop. The
+     * greenlets keep what they have.
+     */
+    inline void enable_accounting(bool enabled) noexcept
+    {
+        this->_accounting = enabled;
+        this->_resumed_ns = enabled ? SwitchStats::now_ns() : 0;
+        this->_accounted_ns = 0;
+        this->_accounted_switches = 0;
+    }
+
+    /**
+     * Called, if accounting is enabled, when a switch completes at
+     * *now*. Returns how long the greenlet that switched away ran.
+     */
+    inline int64_t account_switch(int64_t now) noexcept
+    {
+        const int64_t ran = now - this->_resumed_ns;
+        this->_resumed_ns = now;
+        this->_accounted_ns += ran;
+        ++this->_accounted_switches;
+        return ran;
+    }
+
+    /**
+     * When the current greenlet was resumed, or accounting was
+     * enabled if that was later.
+     */
+    inline int64_t resumed_ns() const noexcept
+    {
+        return this->_resumed_ns;
+    }
+
+    inline int64_t accounted_ns() const noexcept
+    {
+        return this->_accounted_ns;
+    }
+
+    inline uint64_t accounted_switches() const noexcept
+    {
+        return this->_accounted_switches;
+    }
+
+#if GREENLET_USE_DEDICATED_STACKS
+    /**
+     * The pool for dedicated stacks, creating it if need be. Returns
+     * null if it can't be allocated.
+     */
+    inline DedicatedStackPool* dedicated_stack_pool() noexcept
+    {
+        if (!this->_dedicated_stack_pool) {
+            this->_dedicated_stack_pool = DedicatedStackPool::create();
+        }
+        return this->_dedicated_stack_pool;
+    }
+
+    /**
+     * The pool for dedicated stacks, or null if this thread hasn't
+     * needed one.
+     */
+    inline DedicatedStackPool* borrow_dedicated_stack_pool() const noexcept
+    {
+        return this->_dedicated_stack_pool;
+    }
+#endif
+
 private:
     /**
      * Deref and remove the greenlets from the deleteme list. Must be
@@ -393,6 +736,16 @@ private:
 
 public:
 
+    /**
+     * The events a trace function can be called for.
+     */
+    enum TraceEvent {
+        TRACE_SWITCH = 1,
+        TRACE_THROW = 2,
+        TRACE_START = 4,
+        TRACE_FINISH = 8
+    };
+
     /**
      * Returns a new reference, or a false object.
      */
@@ -401,16 +754,107 @@ public:
         return tracefunc;
     };
 
+    /**
+     * Returns a new reference to the trace function if it should be
+     * called for *event* this time, or a false object. This counts
+     * towards the sampling, so call it only once per event.
+     */
+    inline OwnedObject get_tracefunc(TraceEvent event) noexcept
+    {
+        if (!this->tracefunc || !(this->_trace_events & event)) {
+            return OwnedObject();
+        }
+        if (this->_trace_sample > 1) {
+            if (this->_trace_sample_randomly) {
+                uint32_t x = this->_trace_random_state;
+                x ^= x << 13;
+                x ^= x >> 17;
+                x ^= x << 5;
+                this->_trace_random_state = x;
+                if (x % this->_trace_sample) {
+                    return OwnedObject();
+                }
+            }
+            else if (--this->_trace_countdown) {
+                return OwnedObject();
+            }
+            else {
+                this->_trace_countdown = this->_trace_sample;
+            }
+        }
+        return this->tracefunc;
+    }
+
+    inline unsigned int trace_events() const noexcept
+    {
+        return this->_trace_events;
+    }
+
+    inline unsigned int trace_sample() const noexcept
+    {
+        return this->_trace_sample;
+    }
+
+    inline bool trace_sample_randomly() const noexcept
+    {
+        return this->_trace_sample_randomly;
+    }
 
     inline void set_tracefunc(BorrowedObject tracefunc)
+    {
+        this->set_tracefunc(tracefunc, TRACE_SWITCH | TRACE_THROW, 1, false);
+    }
+
+    /**
+     * Set the trace function, to be called for the *events* (a mask
+     * of TraceEvent), but only for one in *sample* of them: either
+     * every *sample*-th, or, if *randomly*, each with a chance of one
+     * in *sample*.
+     */
+    inline void set_tracefunc(BorrowedObject tracefunc,
+                              unsigned int events,
+                              unsigned int sample,
+                              bool randomly)
     {
         assert(tracefunc);
+        assert(sample > 0);
         if (tracefunc == BorrowedObject(Py_None)) {
             this->tracefunc.CLEAR();
         }
         else {
             this->tracefunc = tracefunc;
         }
+        this->_trace_events = events;
+        this->_trace_sample = this->_trace_countdown = sample;
+        this->_trace_sample_randomly = randomly;
+    }
+
+    inline PyGreenlet_TraceHook trace_hook() const noexcept
+    {
+        return this->_trace_hook;
+    }
+
+    inline void* trace_hook_arg() const noexcept
+    {
+        return this->_trace_hook_arg;
+    }
+
+    inline void set_trace_hook(PyGreenlet_TraceHook hook, void* arg) noexcept
+    {
+        this->_trace_hook = hook;
+        this->_trace_hook_arg = hook ? arg : nullptr;
+    }
+
+    /**
+     * Tell the C trace hook, if there is one, about a switch.
+     */
+    inline void call_trace_hook(int event,
+                                PyGreenlet* origin,
+                                PyGreenlet* target) const noexcept
+    {
+        if (this->_trace_hook) {
+            this->_trace_hook(event, origin, target, this->_trace_hook_arg);
+        }
     }
 
     /**
@@ -462,6 +906,18 @@ public:
     // running the greenlets.
     ~ThreadState()
     {
+        delete this->_switch_stats;
+        this->_switch_stats = nullptr;
+        // If we're running in another thread, its history isn't
+        // this one.
+        if (g_thread_switch_history == this->_switch_history) {
+            g_thread_switch_history = nullptr;
+            std::atomic_signal_fence(std::memory_order_seq_cst);
+        }
+        delete this->_switch_history;
+        this->_switch_history = nullptr;
+        delete this->_blocking_watch;
+        this->_blocking_watch = nullptr;
         if (!PyInterpreterState_Head()) {
             // We shouldn't get here (our callers protect us)
             // but if we do, all we can do is bail early.
@@ -478,6 +934,8 @@ public:
         // these APIs remain safe during shutdown.
         if (greenlet::IsShuttingDown()) {
             this->tracefunc.CLEAR();
+            this->saved_stack_budget_callback.CLEAR();
+            this->blocking_callback.CLEAR();
             if (this->current_greenlet) {
                 this->current_greenlet->murder_in_place();
                 this->current_greenlet.CLEAR();
@@ -492,6 +950,19 @@ public:
         //assert(!this->switching_state.origin);
 
         this->tracefunc.CLEAR();
+        this->saved_stack_budget_callback.CLEAR();
+        this->blocking_callback.CLEAR();
+        // Only now is it safe to give back the buffers; when we're
+        // shutting down (above) we leak them like everything else.
+        this->_stack_copy_pool.trim();
+#if GREENLET_USE_DEDICATED_STACKS
+        // Greenlets that never finished may still be using some
+        // stacks; those will be unmapped when they're done with.
+        if (this->_dedicated_stack_pool) {
+            this->_dedicated_stack_pool->orphan();
+            this->_dedicated_stack_pool = nullptr;
+        }
+#endif
 
         // Forcibly GC as much as we can.
         this->clear_deleteme_list(true);
@@ -555,7 +1026,7 @@ public:
                         // This happens in older versions of CPython
                         // that create a bound method object somewhere
                         // on the stack that we'll never get back to.
-                        if (PyCFunction_GetFunction(refs.at(0).borrow()) == (PyCFunction)green_switch) {
+                        if (PyCFunction_GetFunction(refs.at(0).borrow()) == (PyCFunction)green_switch_fastcall) {
                             BorrowedObject function_w = refs.at(0);
                             refs.clear(); // destroy the reference
                                           // from the list.
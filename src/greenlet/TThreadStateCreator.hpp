@@ -55,6 +55,15 @@ public:
         this->_state = nullptr;
     }
 
+    /**
+     * The state, or null if it hasn't been created (or has been
+     * destroyed). Unlike state(), this never creates it.
+     */
+    inline ThreadState* borrow_state() const noexcept
+    {
+        return this->has_state() ? this->_state : nullptr;
+    }
+
     inline ThreadState& state()
     {
         // The main greenlet will own this pointer when it is created,
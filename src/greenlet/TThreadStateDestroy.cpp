@@ -211,7 +211,7 @@ private:
 // in contrast, static volatile variables are at some pre-computed
 // offset.
 typedef greenlet::ThreadStateCreator<greenlet::ThreadState_DestroyNoGIL::MarkGreenletDeadAndQueueCleanup> ThreadStateCreator;
-static thread_local ThreadStateCreator g_thread_state_global;
+static thread_local ThreadStateCreator g_thread_state_global GREENLET_TLS_INITIAL_EXEC;
 #define GET_THREAD_STATE() g_thread_state_global
 
 #endif //T_THREADSTATE_DESTROY
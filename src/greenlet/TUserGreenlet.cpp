@@ -14,9 +14,14 @@
 
 #include "greenlet_internal.hpp"
 #include "TGreenlet.hpp"
+#include "greenlet_usdt.hpp"
 
 #include "TThreadStateDestroy.cpp"
 
+#if GREENLET_USE_DEDICATED_STACKS
+#include <ucontext.h>
+#endif
+
 
 namespace greenlet {
 using greenlet::refs::BorrowedMainGreenlet;
@@ -36,7 +41,12 @@ void UserGreenlet::operator delete(void* ptr)
 
 
 UserGreenlet::UserGreenlet(PyGreenlet* p, BorrowedGreenlet the_parent)
-    : Greenlet(p), _parent(the_parent)
+    : UserGreenlet(p, the_parent, Kind::USER)
+{
+}
+
+UserGreenlet::UserGreenlet(PyGreenlet* p, BorrowedGreenlet the_parent, Kind kind)
+    : Greenlet(p, kind), _parent(the_parent), _stack_size(0)
 {
 }
 
@@ -115,7 +125,7 @@ UserGreenlet::was_running_in_dead_thread() const noexcept
 }
 
 OwnedObject
-UserGreenlet::g_switch()
+UserGreenlet::g_switch(ThreadState& current_thread_state)
 {
     try {
         if (!this->args() && !PyErr_Occurred()) {
@@ -132,7 +142,7 @@ UserGreenlet::g_switch()
             throw PyErrOccurred(mod_globs->PyExc_GreenletError,
                                 "cannot switch with no pending arguments or exception");
         }
-        this->check_switch_allowed();
+        this->check_switch_allowed(current_thread_state);
     }
     catch (const PyErrOccurred&) {
         this->release_args();
@@ -182,7 +192,7 @@ UserGreenlet::g_switch()
                 // This can only throw back to us while we're
                 // still in this greenlet. Once the new greenlet
                 // is bootstrapped, it has its own exception state.
-                err = real_target->g_initialstub(&dummymarker);
+                err = real_target->g_initialstub(&dummymarker, current_thread_state);
             }
             catch (const PyErrOccurred&) {
                 this->release_args();
@@ -224,8 +234,25 @@ UserGreenlet::g_switch()
 
 
 
+#if GREENLET_USE_DEDICATED_STACKS
+// What g_initialstub() hands to dedicated_stack_bootstrap().
+struct dedicated_stack_start_t
+{
+    UserGreenlet* greenlet = nullptr;
+    PyGreenlet* origin = nullptr;
+    PyObject* run = nullptr;
+    DedicatedStack* stack = nullptr;
+};
+
+#if Py_GIL_DISABLED
+static thread_local dedicated_stack_start_t dedicated_stack_start GREENLET_TLS_INITIAL_EXEC;
+#else
+static dedicated_stack_start_t dedicated_stack_start;
+#endif
+#endif
+
 Greenlet::switchstack_result_t
-UserGreenlet::g_initialstub(void* mark)
+GREENLET_NOINLINE(UserGreenlet::g_initialstub)(void* mark, ThreadState& thread_state)
 {
     OwnedObject run;
 
@@ -250,7 +277,7 @@ UserGreenlet::g_initialstub(void* mark)
 
 
         /* recheck that it's safe to switch in case greenlet reparented anywhere above */
-        this->check_switch_allowed();
+        this->check_switch_allowed(thread_state);
 
         /* by the time we got here another start could happen elsewhere,
          * that means it should now be a regular switch.
@@ -269,6 +296,23 @@ UserGreenlet::g_initialstub(void* mark)
         }
     }
 
+#if GREENLET_USE_DEDICATED_STACKS
+    DedicatedStack* dedicated_stack = nullptr;
+    if (this->_stack_size) {
+        DedicatedStackPool* const pool = thread_state.dedicated_stack_pool();
+        if (pool) {
+            dedicated_stack = pool->acquire(this->_stack_size);
+        }
+        else {
+            errno = ENOMEM;
+        }
+        if (!dedicated_stack) {
+            PyErr_SetFromErrno(PyExc_MemoryError);
+            throw PyErrOccurred();
+        }
+    }
+#endif
+
     // Sweet, if we got here, we have the go-ahead and will switch
     // greenlets.
     // Nothing we do from here on out should allow for a thread or
@@ -288,7 +332,6 @@ UserGreenlet::g_initialstub(void* mark)
     this->python_state.set_new_cframe(trace_info);
 #endif
     /* start the greenlet */
-    ThreadState& thread_state = GET_THREAD_STATE().state();
     this->stack_state = StackState(mark,
                                    thread_state.borrow_current()->stack_state);
     this->python_state.set_initial_state(PyThreadState_GET());
@@ -309,6 +352,25 @@ UserGreenlet::g_initialstub(void* mark)
     */
     if (err.status == 1) {
         // In the new greenlet.
+#if GREENLET_USE_DEDICATED_STACKS
+        if (dedicated_stack) {
+            // Leave this stack behind entirely and carry on at the
+            // top of our own. The stack-based variables we need are
+            // passed through a global, as in g_switchstack().
+            ucontext_t there;
+            dedicated_stack_start.greenlet = this;
+            dedicated_stack_start.origin = err.origin_greenlet.relinquish_ownership();
+            dedicated_stack_start.run = run.relinquish_ownership();
+            dedicated_stack_start.stack = dedicated_stack;
+            getcontext(&there);
+            there.uc_stack.ss_sp = dedicated_stack->mapping();
+            there.uc_stack.ss_size = dedicated_stack->top() - dedicated_stack->mapping();
+            there.uc_link = nullptr;
+            makecontext(&there, &UserGreenlet::dedicated_stack_bootstrap, 0);
+            setcontext(&there);
+            Py_FatalError("greenlet: failed to move to a dedicated stack.");
+        }
+#endif
 
         // This never returns! Calling inner_bootstrap steals
         // the contents of our run object within this stack frame, so
@@ -371,6 +433,11 @@ UserGreenlet::g_initialstub(void* mark)
     /* back in the parent */
     if (err.status < 0) {
         /* start failed badly, restore greenlet state */
+#if GREENLET_USE_DEDICATED_STACKS
+        if (dedicated_stack) {
+            dedicated_stack->decref();
+        }
+#endif
         this->stack_state = StackState();
         this->_main_greenlet.CLEAR();
         // CAUTION: This may run arbitrary Python code.
@@ -387,6 +454,41 @@ UserGreenlet::g_initialstub(void* mark)
 }
 
 
+#if GREENLET_USE_DEDICATED_STACKS
+void
+UserGreenlet::dedicated_stack_bootstrap()
+{
+    UserGreenlet* const self = dedicated_stack_start.greenlet;
+    PyGreenlet* const origin = dedicated_stack_start.origin;
+    PyObject* const run = dedicated_stack_start.run;
+    DedicatedStack* const stack = dedicated_stack_start.stack;
+    dedicated_stack_start = dedicated_stack_start_t();
+
+    self->stack_state.move_to_dedicated_stack(
+        stack,
+        self->thread_state()->thread_stack_chain_head());
+#if GREENLET_USE_CFRAME
+    // The interpreter writes back to the bottom-most CFrame of the
+    // greenlet when the greenlet finishes, so that can't be the one
+    // that g_initialstub() left on the stack we just abandoned.
+    _PyCFrame trace_info;
+    self->python_state.set_new_cframe(trace_info);
+    PyThreadState_GET()->cframe = &trace_info;
+#endif
+
+    // There's nothing underneath us to propagate C++ exceptions to.
+    try {
+        self->inner_bootstrap(origin, run);
+    }
+    catch (const std::exception& e) {
+        std::string base = "greenlet: Unhandled C++ exception: ";
+        base += e.what();
+        Py_FatalError(base.c_str());
+    }
+    Py_FatalError("greenlet: inner_bootstrap returned with no exception.\n");
+}
+#endif
+
 void
 UserGreenlet::inner_bootstrap(PyGreenlet* origin_greenlet, PyObject* run)
 {
@@ -400,7 +502,8 @@ UserGreenlet::inner_bootstrap(PyGreenlet* origin_greenlet, PyObject* run)
     //PyObject* run = _run.relinquish_ownership();
 
     /* in the new greenlet */
-    assert(this->thread_state()->borrow_current() == BorrowedGreenlet(this->_self));
+    ThreadState& thread_state = *this->thread_state();
+    assert(thread_state.borrow_current() == BorrowedGreenlet(this->_self));
     // C++ exceptions cannot propagate to the parent greenlet from
     // here. (TODO: Do we need a catch(...) clause, perhaps on the
     // function itself? ALl we could do is terminate the program.)
@@ -409,7 +512,7 @@ UserGreenlet::inner_bootstrap(PyGreenlet* origin_greenlet, PyObject* run)
     // the depth of the SEH list. The call to restore it MUST NOT
     // add a new SEH handler to the list, or we'll restore it to
     // the wrong thing.
-    this->thread_state()->restore_exception_state();
+    thread_state.restore_exception_state();
     /* stack variables from above are no good and also will not unwind! */
     // EXCEPT: That can't be true, we access run, among others, here.
 
@@ -434,11 +537,16 @@ UserGreenlet::inner_bootstrap(PyGreenlet* origin_greenlet, PyObject* run)
     // The first switch we need to manually call the trace
     // function here instead of in g_switch_finish, because we
     // never return there.
-    if (OwnedObject tracefunc = this->thread_state()->get_tracefunc()) {
+    thread_state.call_trace_hook(args ? PyGreenlet_TRACE_SWITCH : PyGreenlet_TRACE_THROW,
+                                 origin_greenlet,
+                                 this->_self);
+    if (OwnedObject tracefunc = thread_state.get_tracefunc(
+            args ? ThreadState::TRACE_SWITCH : ThreadState::TRACE_THROW)) {
         OwnedGreenlet trace_origin;
         trace_origin = origin_greenlet;
         try {
-            g_calltrace(tracefunc,
+            g_calltrace(thread_state,
+                        tracefunc,
                         args ? mod_globs->event_switch : mod_globs->event_throw,
                         trace_origin,
                         this->_self);
@@ -448,6 +556,27 @@ UserGreenlet::inner_bootstrap(PyGreenlet* origin_greenlet, PyObject* run)
             args.CLEAR();
         }
     }
+    // If we're going to call run(), that's the start.
+    if (args) {
+        if (OwnedObject tracefunc = thread_state.get_tracefunc(ThreadState::TRACE_START)) {
+            OwnedGreenlet trace_origin;
+            trace_origin = origin_greenlet;
+            try {
+                g_calltrace(thread_state,
+                            tracefunc,
+                            mod_globs->event_start,
+                            trace_origin,
+                            this->_self);
+            }
+            catch (const PyErrOccurred&) {
+                args.CLEAR();
+            }
+        }
+        GREENLET_PROBE2(start, this->_self, this->_parent.borrow());
+    }
+
+    // Likewise for the saved-stack budget.
+    thread_state.check_saved_stack_budget();
 
     // We no longer need the origin, it was only here for
     // tracing.
@@ -469,7 +598,14 @@ UserGreenlet::inner_bootstrap(PyGreenlet* origin_greenlet, PyObject* run)
             // CAUTION: Just invoking this, before the function even
             // runs, may cause memory allocations, which may trigger
             // GC, which may run arbitrary Python code.
-            result = OwnedObject::consuming(PyObject_Call(this->_run_callable.borrow(), args.args().borrow(), args.kwargs().borrow()));
+            OwnedObject run_args = args.args();
+            if (args.single()) {
+                // It's the only argument.
+                run_args = OwnedObject::consuming(PyTuple_Pack(1, run_args.borrow()));
+            }
+            if (run_args) {
+                result = OwnedObject::consuming(PyObject_Call(this->_run_callable.borrow(), run_args.borrow(), args.kwargs().borrow()));
+            }
         }
         catch (...) {
             // Unhandled C++ exception!
@@ -530,7 +666,6 @@ UserGreenlet::inner_bootstrap(PyGreenlet* origin_greenlet, PyObject* run)
         // See test_dealloc_switch_args_not_lost
         PyErrPieces clear_error;
         result <<= this->args();
-        result = single_result(result);
     }
     this->release_args();
     this->python_state.did_finish(PyThreadState_GET());
@@ -538,6 +673,24 @@ UserGreenlet::inner_bootstrap(PyGreenlet* origin_greenlet, PyObject* run)
     result = g_handle_exit(result);
     assert(this->thread_state()->borrow_current() == this->_self);
 
+    if (OwnedObject tracefunc = thread_state.get_tracefunc(ThreadState::TRACE_FINISH)) {
+        // Whatever we're returning or raising is kept aside while
+        // this runs; if it raises, that's what the parent gets
+        // instead.
+        assert(this->_parent);
+        try {
+            g_calltrace(thread_state,
+                        tracefunc,
+                        mod_globs->event_finish,
+                        this->_self,
+                        this->_parent);
+        }
+        catch (const PyErrOccurred&) {
+            result.CLEAR();
+        }
+    }
+    GREENLET_PROBE3(finish, this->_self, this->_parent.borrow(), result ? 0 : 1);
+
     /* jump back to parent */
     this->stack_state.set_inactive(); /* dead */
 
@@ -589,6 +742,28 @@ UserGreenlet::run(const BorrowedObject nrun)
     this->_run_callable = nrun;
 }
 
+void
+UserGreenlet::stack_size(size_t nbytes)
+{
+#if GREENLET_USE_DEDICATED_STACKS
+    if (this->started()) {
+        throw ValueError("the stack size cannot be changed "
+                         "after the start of the greenlet");
+    }
+    if (nbytes && nbytes < DedicatedStack::MIN_SIZE) {
+        throw PyErrOccurred(PyExc_ValueError,
+                            "stack_size must be at least "
+                            + std::to_string(DedicatedStack::MIN_SIZE)
+                            + " bytes");
+    }
+    this->_stack_size = nbytes;
+#else
+    if (nbytes) {
+        throw ValueError("setting the stack size is not supported on this platform");
+    }
+#endif
+}
+
 const OwnedGreenlet
 UserGreenlet::parent() const
 {
@@ -632,13 +807,6 @@ UserGreenlet::murder_in_place()
     Greenlet::murder_in_place();
 }
 
-bool
-UserGreenlet::belongs_to_thread(const ThreadState* thread_state) const
-{
-    return Greenlet::belongs_to_thread(thread_state) && this->_main_greenlet == thread_state->borrow_main_greenlet();
-}
-
-
 int
 UserGreenlet::tp_traverse(visitproc visit, void* arg)
 {
@@ -14,6 +14,7 @@ __all__ = [
     'greenlet',
 
     'gettrace',
+    'gettrace_config',
     'settrace',
 ]
 
@@ -41,6 +42,7 @@ from ._greenlet import greenlet
 # tracing
 ###
 from ._greenlet import gettrace
+from ._greenlet import gettrace_config
 from ._greenlet import settrace
 
 ###
@@ -59,4 +61,36 @@ from ._greenlet import CLOCKS_PER_SEC # pylint:disable=unused-import
 from ._greenlet import enable_optional_cleanup # pylint:disable=unused-import
 from ._greenlet import get_clocks_used_doing_optional_cleanup # pylint:disable=unused-import
 
+# Controlling the memory used to hold the stacks of suspended
+# greenlets. Provisional API.
+from ._greenlet import get_stack_copy_pool_stats # pylint:disable=unused-import
+from ._greenlet import set_stack_copy_pool_limit # pylint:disable=unused-import
+from ._greenlet import set_stack_copy_retention_limit # pylint:disable=unused-import
+from ._greenlet import set_stack_copy_packing_limit # pylint:disable=unused-import
+from ._greenlet import set_stack_copy_packing_idle # pylint:disable=unused-import
+from ._greenlet import trim_stack_copy_pool # pylint:disable=unused-import
+from ._greenlet import get_saved_stack_stats # pylint:disable=unused-import
+from ._greenlet import set_saved_stack_budget # pylint:disable=unused-import
+# Whether ``greenlet(stack_size=...)`` is available, and the stacks
+# used for it. Provisional API.
+from ._greenlet import GREENLET_USE_DEDICATED_STACKS # pylint:disable=unused-import
+from ._greenlet import get_dedicated_stack_pool_stats # pylint:disable=unused-import
+from ._greenlet import set_dedicated_stack_pool_limit # pylint:disable=unused-import
+from ._greenlet import set_dedicated_stack_pool_resident_limit # pylint:disable=unused-import
+from ._greenlet import trim_dedicated_stack_pool # pylint:disable=unused-import
+# Statistics about switching, and a record of recent switches.
+# Provisional API.
+from ._greenlet import enable_switch_stats # pylint:disable=unused-import
+from ._greenlet import get_switch_stats # pylint:disable=unused-import
+from ._greenlet import enable_switch_history # pylint:disable=unused-import
+from ._greenlet import get_switch_history # pylint:disable=unused-import
+from ._greenlet import dump_switch_history # pylint:disable=unused-import
+from ._greenlet import enable_greenlet_accounting # pylint:disable=unused-import
+from ._greenlet import get_greenlet_accounting # pylint:disable=unused-import
+from ._greenlet import set_blocking_watchdog # pylint:disable=unused-import
+# Switching to ready greenlets, and passing objects between them, from C.
+# Provisional API.
+from ._greenlet import RunQueue # pylint:disable=unused-import
+from ._greenlet import Channel # pylint:disable=unused-import
+
 # Other APIS in the _greenlet module are for test support.
@@ -35,14 +35,20 @@
 #include "TExceptionState.cpp"
 #include "TPythonState.cpp"
 #include "TStackState.cpp"
+#include "TStackCopyPool.cpp"
+#include "TSwitchStats.cpp"
+#include "TDedicatedStack.cpp"
 
 #include "TThreadState.hpp"
 #include "TThreadStateCreator.hpp"
 #include "TThreadStateDestroy.cpp"
+#include "TBlockingWatchdog.cpp"
 
 #include "PyGreenlet.cpp"
 #include "PyGreenletUnswitchable.cpp"
 #include "CObjects.cpp"
+#include "PyRunQueue.cpp"
+#include "PyChannel.cpp"
 
 using greenlet::LockGuard;
 using greenlet::LockInitError;
@@ -215,12 +221,16 @@ greenlet_internal_mod_init() noexcept
 
         Require(PyType_Ready(&PyGreenlet_Type));
         Require(PyType_Ready(&PyGreenletUnswitchable_Type));
+        Require(PyType_Ready(&PyRunQueue_Type));
+        Require(PyType_Ready(&PyChannel_Type));
 
         mod_globs = new greenlet::GreenletGlobals;
         ThreadState::init();
 
         m.PyAddObject("greenlet", PyGreenlet_Type);
         m.PyAddObject("UnswitchableGreenlet", PyGreenletUnswitchable_Type);
+        m.PyAddObject("RunQueue", PyRunQueue_Type);
+        m.PyAddObject("Channel", PyChannel_Type);
         m.PyAddObject("error", mod_globs->PyExc_GreenletError);
         m.PyAddObject("GreenletExit", mod_globs->PyExc_GreenletExit);
 
@@ -228,6 +238,7 @@ greenlet_internal_mod_init() noexcept
         m.PyAddObject("GREENLET_USE_TRACING", 1);
         m.PyAddObject("GREENLET_USE_CONTEXT_VARS", 1L);
         m.PyAddObject("GREENLET_USE_STANDARD_THREADING", 1L);
+        m.PyAddObject("GREENLET_USE_DEDICATED_STACKS", long(GREENLET_USE_DEDICATED_STACKS));
 
         NewReference clocks_per_sec(Require(PyLong_FromSsize_t(CLOCKS_PER_SEC)));
         m.PyAddObject("CLOCKS_PER_SEC", clocks_per_sec);
@@ -265,6 +276,9 @@ greenlet_internal_mod_init() noexcept
         _PyGreenlet_API[PyGreenlet_STARTED_NUM] = (void*)Extern_PyGreenlet_STARTED;
         _PyGreenlet_API[PyGreenlet_ACTIVE_NUM] = (void*)Extern_PyGreenlet_ACTIVE;
         _PyGreenlet_API[PyGreenlet_GET_PARENT_NUM] = (void*)Extern_PyGreenlet_GET_PARENT;
+        _PyGreenlet_API[PyGreenlet_SetTraceHook_NUM] = (void*)PyGreenlet_SetTraceHook;
+        _PyGreenlet_API[PyGreenlet_GetTraceHook_NUM] = (void*)PyGreenlet_GetTraceHook;
+        _PyGreenlet_API[PyGreenlet_DumpSwitchHistory_NUM] = (void*)PyGreenlet_DumpSwitchHistory;
 
         /* XXX: Note that our module name is ``greenlet._greenlet``, but for
            backwards compatibility with existing C code, we need the _C_API to
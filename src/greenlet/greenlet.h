@@ -28,11 +28,29 @@ typedef struct _greenlet {
 
 #define PyGreenlet_Check(op) (op && PyObject_TypeCheck(op, &PyGreenlet_Type))
 
+/*
+ * The events passed to a PyGreenlet_TraceHook.
+ */
+#define PyGreenlet_TRACE_SWITCH 0
+#define PyGreenlet_TRACE_THROW 1
+
+/*
+ * A C function called on each switch in a thread, like the function
+ * passed to ``greenlet.settrace()``, but without any Python objects
+ * being created to call it. *origin* and *target* are borrowed
+ * references, and *arg* is whatever was given to
+ * PyGreenlet_SetTraceHook().
+ */
+typedef void (*PyGreenlet_TraceHook)(int event,
+                                     PyGreenlet* origin,
+                                     PyGreenlet* target,
+                                     void* arg);
+
 
 /* C API functions */
 
 /* Total number of symbols that are exported */
-#define PyGreenlet_API_pointers 12
+#define PyGreenlet_API_pointers 15
 
 #define PyGreenlet_Type_NUM 0
 #define PyExc_GreenletError_NUM 1
@@ -49,6 +67,10 @@ typedef struct _greenlet {
 #define PyGreenlet_ACTIVE_NUM 10
 #define PyGreenlet_GET_PARENT_NUM 11
 
+#define PyGreenlet_SetTraceHook_NUM 12
+#define PyGreenlet_GetTraceHook_NUM 13
+#define PyGreenlet_DumpSwitchHistory_NUM 14
+
 #ifndef GREENLET_MODULE
 /* This section is used by modules that uses the greenlet C API */
 static void** _PyGreenlet_API = NULL;
@@ -144,6 +166,41 @@ static void** _PyGreenlet_API = NULL;
     (*(int (*)(PyGreenlet*))                                         \
      _PyGreenlet_API[PyGreenlet_ACTIVE_NUM])
 
+/*
+ * PyGreenlet_SetTraceHook(PyGreenlet_TraceHook hook, void* arg)
+ *
+ * Call hook(event, origin, target, arg) on each switch in the current
+ * thread, or stop if hook is NULL. Returns 0, or -1 with an exception
+ * set.
+ */
+#     define PyGreenlet_SetTraceHook                                 \
+    (*(int (*)(PyGreenlet_TraceHook, void*))                         \
+     _PyGreenlet_API[PyGreenlet_SetTraceHook_NUM])
+
+/*
+ * PyGreenlet_GetTraceHook(void** arg)
+ *
+ * Return the hook set in the current thread, or NULL, storing its arg
+ * in *arg unless that's NULL.
+ */
+#     define PyGreenlet_GetTraceHook                                 \
+    (*(PyGreenlet_TraceHook (*)(void**))                             \
+     _PyGreenlet_API[PyGreenlet_GetTraceHook_NUM])
+
+/*
+ * PyGreenlet_DumpSwitchHistory(int fd)
+ *
+ * Write the switches recorded in the current thread (see
+ * greenlet.enable_switch_history()) to fd. Returns 0, or -1 if they
+ * aren't being recorded. This doesn't allocate memory, use Python or
+ * need the GIL, so it may be called from a fatal error or signal
+ * handler (but see the documentation about thread-local storage
+ * outside glibc).
+ */
+#     define PyGreenlet_DumpSwitchHistory                            \
+    (*(int (*)(int))                                                 \
+     _PyGreenlet_API[PyGreenlet_DumpSwitchHistory_NUM])
+
 
 
 
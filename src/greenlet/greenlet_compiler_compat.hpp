@@ -77,6 +77,22 @@
 #    define UNUSED(x) UNUSED_ ## x
 #endif
 
+// Thread-locals in a shared library use the general-dynamic TLS
+// model by default, so on ELF platforms every access is a call to
+// ``__tls_get_addr()``. The initial-exec model makes it a fixed
+// offset from the thread pointer instead, but it draws on the small
+// amount of static TLS that glibc sets aside for libraries loaded
+// with ``dlopen()``, and other C libraries (musl) may refuse to load
+// us at all. Our thread-locals are only a few words, so use it when
+// we know it's safe. Define this to nothing to opt out.
+#ifndef GREENLET_TLS_INITIAL_EXEC
+#    if defined(__GLIBC__) && defined(__ELF__) && (defined(__GNUC__) || defined(__clang__))
+#        define GREENLET_TLS_INITIAL_EXEC __attribute__((tls_model("initial-exec")))
+#    else
+#        define GREENLET_TLS_INITIAL_EXEC
+#    endif
+#endif
+
 #if defined(_MSC_VER)
 #    define G_NOEXCEPT_WIN32 noexcept
 #else
@@ -95,6 +95,10 @@ extern PyTypeObject PyGreenlet_Type;
   * Forward declarations needed in multiple files.
   */
 static PyObject* green_switch(PyGreenlet* self, PyObject* args, PyObject* kwargs);
+static PyObject* green_switch_fastcall(PyGreenlet* self,
+                                       PyObject* const* args,
+                                       Py_ssize_t nargs,
+                                       PyObject* kwnames);
 
 
 #ifdef __clang__
@@ -0,0 +1,129 @@
+/* -*- indent-tabs-mode: nil; tab-width: 4; -*- */
+#ifndef GREENLET_STACK_COPY_HPP
+#define GREENLET_STACK_COPY_HPP
+
+/**
+ * The packed form used for saved greenlet stacks.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace greenlet {
+namespace stack_copy {
+
+    /**
+     * Packing saved stacks to take less memory.
+     *
+     * Much of a saved stack is usually zeros: padding, unused parts
+     * of buffers, locals that were cleared or never set. The packed
+     * form is a series of runs, each a header giving a number of
+     * 8-byte words to copy (which follow the header) and a number of
+     * zero words after them, and then the last ``n % 8`` bytes as
+     * they are. A new run is only started for at least one whole
+     * zero word, so the packed form is never more than one header
+     * bigger than the original.
+     */
+    struct PackedRun
+    {
+        uint32_t literal_words;
+        uint32_t zero_words;
+    };
+
+    static const size_t PACK_WORD = 8;
+
+    /**
+     * The most memory ``pack()`` can need for *n* bytes.
+     */
+    static inline size_t pack_bound(size_t n) noexcept
+    {
+        return n + sizeof(PackedRun);
+    }
+
+    static inline bool pack_word_is_zero(const char* p) noexcept
+    {
+        uint64_t word;
+        memcpy(&word, p, PACK_WORD);
+        return word == 0;
+    }
+
+    /**
+     * Pack the *n* bytes at *src* into *dest*, which must have room
+     * for ``pack_bound(n)`` bytes. Returns the packed size.
+     */
+    static size_t pack(char* dest, const char* src, size_t n) noexcept
+    {
+        // Runs are limited to what fits in the header; stacks never
+        // get anywhere near that.
+        const size_t max_run = UINT32_MAX;
+        const size_t nwords = n / PACK_WORD;
+        char* out = dest;
+        size_t i = 0;
+        while (i < nwords) {
+            const size_t literal_start = i;
+            while (i < nwords
+                   && i - literal_start < max_run
+                   && !pack_word_is_zero(src + i * PACK_WORD)) {
+                ++i;
+            }
+            const size_t literal_end = i;
+            while (i < nwords
+                   && i - literal_end < max_run
+                   && pack_word_is_zero(src + i * PACK_WORD)) {
+                ++i;
+            }
+            PackedRun run;
+            run.literal_words = static_cast<uint32_t>(literal_end - literal_start);
+            run.zero_words = static_cast<uint32_t>(i - literal_end);
+            memcpy(out, &run, sizeof(run));
+            out += sizeof(run);
+            memcpy(out, src + literal_start * PACK_WORD, run.literal_words * PACK_WORD);
+            out += run.literal_words * PACK_WORD;
+        }
+        memcpy(out, src + nwords * PACK_WORD, n % PACK_WORD);
+        out += n % PACK_WORD;
+        return out - dest;
+    }
+
+    /**
+     * Fill [dest, dest + n) with bytes [offset, offset + n) of the
+     * *total* bytes that were packed into *packed*.
+     */
+    static void unpack(char* dest, const char* packed, size_t total,
+                       size_t offset, size_t n) noexcept
+    {
+        const size_t end = offset + n;
+        const size_t words_end = total / PACK_WORD * PACK_WORD;
+        size_t pos = 0;
+        while (pos < words_end && pos < end) {
+            PackedRun run;
+            memcpy(&run, packed, sizeof(run));
+            packed += sizeof(run);
+            const size_t literal_bytes = run.literal_words * PACK_WORD;
+            const size_t zero_bytes = run.zero_words * PACK_WORD;
+            // The part of each piece of this run that we want, if any.
+            size_t lo = std::max(pos, offset);
+            size_t hi = std::min(pos + literal_bytes, end);
+            if (lo < hi) {
+                memcpy(dest + (lo - offset), packed + (lo - pos), hi - lo);
+            }
+            packed += literal_bytes;
+            pos += literal_bytes;
+            lo = std::max(pos, offset);
+            hi = std::min(pos + zero_bytes, end);
+            if (lo < hi) {
+                memset(dest + (lo - offset), 0, hi - lo);
+            }
+            pos += zero_bytes;
+        }
+        if (pos == words_end && pos < end) {
+            const size_t lo = std::max(pos, offset);
+            memcpy(dest + (lo - offset), packed + (lo - pos), end - lo);
+        }
+    }
+
+}; // namespace stack_copy
+}; // namespace greenlet
+
+#endif // GREENLET_STACK_COPY_HPP
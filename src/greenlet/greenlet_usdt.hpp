@@ -0,0 +1,46 @@
+/* -*- indent-tabs-mode: nil; tab-width: 4; -*- */
+#ifndef GREENLET_USDT_HPP
+#define GREENLET_USDT_HPP
+
+/**
+ * Static probe points (USDT, as used by SystemTap, bpftrace, perf
+ * and DTrace) for the switching machinery.
+ *
+ * They're only compiled in when ``GREENLET_USDT`` is defined, which
+ * setup.py does when the environment variable of the same name is
+ * set, and it needs ``<sys/sdt.h>`` (from systemtap-sdt-dev or
+ * systemtap-sdt-devel). A probe that nothing is attached to is a
+ * single ``nop``; its arguments are only evaluated as far as they
+ * need to be in registers or memory, so keep them to values that are
+ * at hand.
+ *
+ * All the probes belong to the provider ``greenlet``. Greenlets are
+ * identified by the address of their PyGreenlet, which is what
+ * ``id()`` gives in Python.
+ *
+ * switch_begin(origin, target, target_saved)
+ *     Before the stacks are swapped; *target_saved* is how many bytes
+ *     of the target's stack have to be copied back in.
+ * switch_end(origin, target, origin_saved)
+ *     After; *origin_saved* is how many bytes of the origin's stack
+ *     were copied out.
+ * start(greenlet, parent)
+ *     A greenlet is about to call its ``run``.
+ * finish(greenlet, parent, failed)
+ *     A greenlet's ``run`` has returned (*failed* is 0) or raised
+ *     (1), and it's about to switch to *parent*.
+ * throw(target, type)
+ *     ``target.throw()`` was called; *type* is the address of the
+ *     exception class (or instance) it was given.
+ */
+
+#ifdef GREENLET_USDT
+#    include <sys/sdt.h>
+#    define GREENLET_PROBE2(name, a, b) DTRACE_PROBE2(greenlet, name, a, b)
+#    define GREENLET_PROBE3(name, a, b, c) DTRACE_PROBE3(greenlet, name, a, b, c)
+#else
+#    define GREENLET_PROBE2(name, a, b) do {} while (0)
+#    define GREENLET_PROBE3(name, a, b, c) do {} while (0)
+#endif
+
+#endif /* GREENLET_USDT_HPP */
@@ -196,6 +196,77 @@ getcurrent_api(PyObject* UNUSED(self))
 
 }
 
+/* What test_trace_hook() has seen: the number of each event, and the
+   most recent greenlets. */
+static struct {
+    Py_ssize_t switches;
+    Py_ssize_t throws;
+    PyGreenlet* origin;
+    PyGreenlet* target;
+} trace_hook_counts;
+
+static void
+trace_hook(int event, PyGreenlet* origin, PyGreenlet* target, void* arg)
+{
+    if (arg != &trace_hook_counts) {
+        return;
+    }
+    if (event == PyGreenlet_TRACE_SWITCH) {
+        trace_hook_counts.switches++;
+    }
+    else if (event == PyGreenlet_TRACE_THROW) {
+        trace_hook_counts.throws++;
+    }
+    trace_hook_counts.origin = origin;
+    trace_hook_counts.target = target;
+}
+
+static PyObject*
+test_set_trace_hook(PyObject* UNUSED(self), PyObject* flag)
+{
+    int is_true = PyObject_IsTrue(flag);
+    if (is_true == -1) {
+        return NULL;
+    }
+    trace_hook_counts.switches = trace_hook_counts.throws = 0;
+    trace_hook_counts.origin = trace_hook_counts.target = NULL;
+    if (PyGreenlet_SetTraceHook(is_true ? trace_hook : NULL,
+                                &trace_hook_counts) < 0) {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject*
+test_get_trace_hook(PyObject* UNUSED(self))
+{
+    void* arg = NULL;
+    PyGreenlet_TraceHook hook = PyGreenlet_GetTraceHook(&arg);
+    if (hook == NULL) {
+        Py_RETURN_NONE;
+    }
+    if (hook != trace_hook || arg != &trace_hook_counts) {
+        PyErr_SetString(PyExc_AssertionError, "Got the wrong trace hook");
+        return NULL;
+    }
+    /* The greenlets are only compared with ``is``, so they may have died. */
+    return Py_BuildValue("nnNN",
+                         trace_hook_counts.switches,
+                         trace_hook_counts.throws,
+                         PyLong_FromVoidPtr(trace_hook_counts.origin),
+                         PyLong_FromVoidPtr(trace_hook_counts.target));
+}
+
+static PyObject*
+test_dump_switch_history(PyObject* UNUSED(self), PyObject* fd)
+{
+    long n = PyLong_AsLong(fd);
+    if (n == -1 && PyErr_Occurred()) {
+        return NULL;
+    }
+    return PyLong_FromLong(PyGreenlet_DumpSwitchHistory((int)n));
+}
+
 static PyMethodDef test_methods[] = {
     {"test_switch",
      (PyCFunction)test_switch,
@@ -239,6 +310,19 @@ static PyMethodDef test_methods[] = {
         (PyCFunction)getcurrent_api,
         METH_NOARGS,
         "Direct call to the PyGreenlet_GetCurrent API."},
+    {"test_set_trace_hook",
+     (PyCFunction)test_set_trace_hook,
+     METH_O,
+     "Set (or, given a false value, clear) a C trace hook that counts events."},
+    {"test_get_trace_hook",
+     (PyCFunction)test_get_trace_hook,
+     METH_NOARGS,
+     "Return None if there's no C trace hook, or what it has counted: \n"
+     "(switches, throws, id(origin), id(target))."},
+    {"test_dump_switch_history",
+     (PyCFunction)test_dump_switch_history,
+     METH_O,
+     "Call PyGreenlet_DumpSwitchHistory() with the given file descriptor."},
     {NULL, NULL, 0, NULL}
 };
 
@@ -0,0 +1,121 @@
+import sys
+import threading
+import time
+
+import greenlet
+from . import TestCase
+
+
+class TestBlockingWatchdog(TestCase):
+
+    def tearDown(self):
+        greenlet.set_blocking_watchdog(1, None)
+        super().tearDown()
+
+    def _hog(self, until, timeout=5):
+        # Never switches; runs Python code, so pending calls get a
+        # chance in this (the main) thread.
+        deadline = time.monotonic() + timeout
+        while not until() and time.monotonic() < deadline:
+            pass
+
+    def test_reports_greenlet_that_doesnt_switch(self):
+        reports = []
+
+        def callback(glet, seconds, stack):
+            reports.append((glet, seconds, stack))
+
+        def hog():
+            self._hog(lambda: reports)
+
+        greenlet.set_blocking_watchdog(0.05, callback)
+        g = greenlet.greenlet(hog)
+        g.switch()
+        self.assertEqual(len(reports), 1)
+        glet, seconds, stack = reports[0]
+        self.assertIs(glet, g)
+        self.assertGreaterEqual(seconds, 0.05)
+        self.assertIn('hog', [frame.name for frame in stack])
+        del reports[:]
+
+    def test_reported_once_per_overrun(self):
+        reports = []
+        greenlet.set_blocking_watchdog(0.02, lambda *args: reports.append(args[0]))
+        main = greenlet.getcurrent()
+        self._hog(lambda: reports)
+        # Still the same overrun.
+        time_spent = time.monotonic() + 0.1
+        self._hog(lambda: time.monotonic() > time_spent)
+        self.assertEqual(reports, [main])
+
+        # Switching starts over.
+        g = greenlet.greenlet(lambda: self._hog(lambda: len(reports) > 1))
+        g.switch()
+        self.assertEqual(reports, [main, g])
+        del reports[:]
+
+    def test_stop(self):
+        reports = []
+        greenlet.set_blocking_watchdog(0.02, reports.append)
+        greenlet.set_blocking_watchdog(0.02, None)
+        time_spent = time.monotonic() + 0.1
+        self._hog(lambda: time.monotonic() > time_spent)
+        self.assertEqual(reports, [])
+
+    def test_other_thread(self):
+        reports = []
+
+        def callback(glet, seconds, stack):
+            reports.append((glet, stack))
+
+        def hog():
+            self._hog(lambda: reports)
+
+        glets = []
+
+        def other_thread():
+            greenlet.set_blocking_watchdog(0.05, callback)
+            glets.append(greenlet.greenlet(hog))
+            glets[0].switch()
+            greenlet.set_blocking_watchdog(1, None)
+
+        t = threading.Thread(target=other_thread)
+        t.start()
+        # Reports are made in this thread.
+        while t.is_alive() and not reports:
+            time.sleep(0.001)
+        t.join(10)
+        self.assertEqual(len(reports), 1)
+        self.assertIs(reports[0][0], glets[0])
+        self.assertIn('hog', [frame.name for frame in reports[0][1]])
+        del reports[:]
+        del glets[:]
+
+    def test_callback_errors_are_unraisable(self):
+        reports = []
+
+        def callback(glet, seconds, stack):
+            reports.append(glet)
+            raise ValueError(seconds)
+
+        unraisable = []
+        old_hook = sys.unraisablehook
+        sys.unraisablehook = unraisable.append
+        try:
+            greenlet.set_blocking_watchdog(0.02, callback)
+            self._hog(lambda: reports)
+        finally:
+            sys.unraisablehook = old_hook
+        self.assertEqual(len(unraisable), 1)
+        self.assertIsInstance(unraisable[0].exc_value, ValueError)
+        self.assertIs(unraisable[0].object, callback)
+        del reports[:]
+        del unraisable[:]
+
+    def test_bad_arguments(self):
+        with self.assertRaises(TypeError):
+            greenlet.set_blocking_watchdog(1, 42)
+        with self.assertRaises(ValueError):
+            greenlet.set_blocking_watchdog(0, print)
+        with self.assertRaises(TypeError):
+            greenlet.set_blocking_watchdog('1', print)
@@ -0,0 +1,240 @@
+"""
+Tests for greenlet.Channel.
+"""
+import threading
+
+import greenlet
+from . import TestCase
+
+
+class TestChannel(TestCase):
+
+    def test_defaults(self):
+        chan = greenlet.Channel()
+        self.assertEqual(chan.maxsize, 0)
+        self.assertIsNone(chan.queue)
+        self.assertEqual(chan.balance, 0)
+        self.assertEqual(len(chan), 0)
+        self.assertIsNone(greenlet.Channel(None).maxsize)
+        with self.assertRaises(ValueError):
+            greenlet.Channel(-1)
+        with self.assertRaises(TypeError):
+            greenlet.Channel(queue=object())
+
+    def test_rendezvous_hands_over_object(self):
+        chan = greenlet.Channel()
+        received = []
+        # Tuples aren't unpacked the way switch() unpacks them.
+        items = [(1,), (), None, 'x']
+
+        def consumer():
+            while True:
+                received.append(chan.receive())
+
+        c = greenlet.greenlet(consumer)
+        c.switch()
+        self.assertEqual(chan.balance, -1)
+        for item in items:
+            chan.send(item)
+        self.assertEqual(chan.balance, -1)
+        self.assertEqual(received, items)
+        self.assertIs(received[0], items[0])
+        # Like any suspended greenlet, a blocked one that refers to the
+        # channel keeps it alive.
+        c.throw()
+        self.assertEqual(chan.balance, 0)
+
+    def test_pipeline(self):
+        # Senders that hand over to a waiting receiver are scheduled
+        # on the queue, so everything runs to completion.
+        queue = greenlet.RunQueue()
+        first = greenlet.Channel(queue=queue)
+        second = greenlet.Channel(queue=queue)
+        results = []
+
+        def produce():
+            for i in range(100):
+                first.send(i)
+            first.send(None)
+
+        def double():
+            while True:
+                item = first.receive()
+                second.send(item if item is None else item * 2)
+                if item is None:
+                    break
+
+        def collect():
+            while True:
+                item = second.receive()
+                if item is None:
+                    break
+                results.append(item)
+
+        glets = [queue.spawn(collect), queue.spawn(double), queue.spawn(produce)]
+        queue.run_until_empty()
+        self.assertTrue(all(g.dead for g in glets))
+        self.assertEqual(results, [i * 2 for i in range(100)])
+
+    def test_blocked_sender(self):
+        chan = greenlet.Channel()
+        log = []
+
+        def sender():
+            chan.send('a')
+            log.append('sent')
+
+        g = greenlet.greenlet(sender)
+        g.switch()
+        self.assertEqual(chan.balance, 1)
+        self.assertEqual(chan.receive(), 'a')
+        self.assertEqual(chan.balance, 0)
+        # Woken, but not switched to.
+        self.assertEqual(log, [])
+        self.assertFalse(g.dead)
+        # The next time something blocks on the channel, it goes there.
+
+        def receiver():
+            log.append(chan.receive())
+
+        r = greenlet.greenlet(receiver)
+        r.switch()
+        self.assertEqual(log, ['sent'])
+        self.assertTrue(g.dead)
+        chan.send('b')
+        self.assertEqual(log, ['sent', 'b'])
+
+    def test_buffered(self):
+        chan = greenlet.Channel(2)
+        chan.send(1)
+        chan.send(2)
+        self.assertEqual(len(chan), 2)
+        log = []
+
+        def sender():
+            chan.send(3)
+            log.append('sent')
+
+        g = greenlet.greenlet(sender)
+        g.switch()
+        self.assertEqual(chan.balance, 1)
+        self.assertEqual(chan.receive(), 1)
+        # The blocked sender's object moved into the buffer.
+        self.assertEqual(len(chan), 2)
+        self.assertEqual(chan.balance, 0)
+        self.assertEqual(chan.receive(), 2)
+        self.assertEqual(chan.receive(), 3)
+        self.assertEqual(log, [])
+        g.switch()
+        self.assertEqual(log, ['sent'])
+
+    def test_unbounded(self):
+        chan = greenlet.Channel(None)
+        for i in range(1000):
+            chan.send(i)
+        self.assertEqual(len(chan), 1000)
+        self.assertEqual([chan.receive() for _ in range(1000)], list(range(1000)))
+
+    def test_main_cannot_block(self):
+        chan = greenlet.Channel()
+        with self.assertRaises(greenlet.error):
+            chan.receive()
+        with self.assertRaises(greenlet.error):
+            chan.send(1)
+        self.assertEqual(chan.balance, 0)
+
+    def test_foreign_switch_to_receiver(self):
+        chan = greenlet.Channel()
+        received = []
+
+        def receiver():
+            received.append(chan.receive())
+            received.append(chan.receive())
+
+        g = greenlet.greenlet(receiver)
+        g.switch()
+        g.switch(1)
+        # As switch() would return it; and it stops waiting.
+        self.assertEqual(received, [1])
+        self.assertEqual(chan.balance, -1)
+        chan.send((2,))
+        self.assertEqual(received, [1, (2,)])
+        self.assertEqual(chan.balance, 0)
+
+    def test_throw_into_receiver(self):
+        chan = greenlet.Channel()
+
+        def receiver():
+            try:
+                chan.receive()
+            except KeyError:
+                return 'caught'
+
+        g = greenlet.greenlet(receiver)
+        g.switch()
+        self.assertEqual(chan.balance, -1)
+        self.assertEqual(g.throw(KeyError), 'caught')
+        self.assertEqual(chan.balance, 0)
+
+    def test_with_queue(self):
+        queue = greenlet.RunQueue()
+        chan = greenlet.Channel(queue=queue)
+        self.assertIs(chan.queue, queue)
+        log = []
+
+        def sender():
+            for i in range(3):
+                chan.send(i)
+            log.append('sender done')
+
+        def receiver():
+            for _ in range(3):
+                log.append(chan.receive())
+            log.append('receiver done')
+
+        queue.spawn(receiver)
+        queue.spawn(sender)
+        queue.run_until_empty()
+        self.assertEqual(log, [0, 1, 2, 'receiver done', 'sender done'])
+
+    def test_queued_wake_dropped_when_resumed_otherwise(self):
+        queue = greenlet.RunQueue()
+        chan = greenlet.Channel(queue=queue)
+        main = greenlet.getcurrent()
+        log = []
+
+        def receiver():
+            log.append(chan.receive())
+
+        def sender():
+            # Its parent is this greenlet, so when it finishes it
+            # resumes the send() before the queue gets to it.
+            greenlet.greenlet(receiver).switch()
+            chan.send('x')
+            log.append('sent')
+            log.append(main.switch())
+
+        g = greenlet.greenlet(sender)
+        g.switch()
+        self.assertEqual(log, ['x', 'sent'])
+        # The wake the channel queued for the sender is stale.
+        self.assertEqual(queue.run_until_empty(), 0)
+        self.assertEqual(log, ['x', 'sent'])
+        g.switch('later')
+        self.assertEqual(log, ['x', 'sent', 'later'])
+        self.assertTrue(g.dead)
+
+    def test_other_thread(self):
+        chan = greenlet.Channel()
+        errors = []
+
+        def run():
+            try:
+                chan.send(1)
+            except greenlet.error as e:
+                errors.append(e)
+
+        t = threading.Thread(target=run)
+        t.start()
+        t.join(10)
+        self.assertEqual(len(errors), 1)
@@ -0,0 +1,356 @@
+"""
+Tests for greenlets that run on a C stack of their own.
+"""
+import gc
+import sys
+import threading
+import unittest
+
+import greenlet
+from greenlet import greenlet as RawGreenlet
+from . import TestCase
+from .leakcheck import ignores_leakcheck
+
+STACK_SIZE = 256 * 1024
+
+
+def _recurse_then_switch(depth, target, value):
+    if depth:
+        return _recurse_then_switch(depth - 1, target, value)
+    return target.switch(value)
+
+
+@unittest.skipUnless(greenlet.GREENLET_USE_DEDICATED_STACKS,
+                     "Dedicated stacks not supported")
+class TestDedicatedStack(TestCase):
+
+    def test_stack_size_attribute(self):
+        self.assertIsNone(RawGreenlet().stack_size)
+        self.assertIsNone(greenlet.getcurrent().stack_size)
+        g = RawGreenlet(stack_size=STACK_SIZE)
+        self.assertEqual(g.stack_size, STACK_SIZE)
+
+    def test_invalid_sizes(self):
+        with self.assertRaises(ValueError):
+            RawGreenlet(stack_size=1024)
+        with self.assertRaises(ValueError):
+            RawGreenlet(stack_size=0)
+        with self.assertRaises(TypeError):
+            RawGreenlet(stack_size='big')
+        with self.assertRaises(TypeError):
+            # Keyword only.
+            RawGreenlet(None, None, STACK_SIZE) # pylint:disable=too-many-function-args
+
+    def test_cannot_change_after_start(self):
+        g = RawGreenlet(lambda: greenlet.getcurrent().parent.switch(),
+                        stack_size=STACK_SIZE)
+        g.switch()
+        with self.assertRaises(ValueError):
+            g.__init__(stack_size=STACK_SIZE * 2)
+        g.switch()
+        self.assertTrue(g.dead)
+
+    def test_switching_saves_nothing(self):
+        main = greenlet.getcurrent()
+
+        def func(depth):
+            while True:
+                depth = _recurse_then_switch(depth, main, None)
+
+        g1 = RawGreenlet(func, stack_size=STACK_SIZE)
+        g2 = RawGreenlet(func, stack_size=STACK_SIZE)
+        for _ in range(5):
+            g1.switch(50)
+            g2.switch(50)
+            self.assertEqual(g1._stack_saved, 0)
+            self.assertEqual(g2._stack_saved, 0)
+            # Nor does the main greenlet need to save anything
+            # to switch to them.
+            self.assertEqual(main._stack_saved, 0)
+
+        # Compare a greenlet sharing the thread's stack.
+        g3 = RawGreenlet(func)
+        g3.switch(50)
+        self.assertGreater(g3._stack_saved, 0)
+        g1.switch(50)
+        self.assertEqual(g1._stack_saved, 0)
+        g3.switch(50)
+
+    def test_results_and_exceptions(self):
+        def func(a, b=2):
+            x = greenlet.getcurrent().parent.switch(a + b)
+            return x * 2
+
+        g = RawGreenlet(func, stack_size=STACK_SIZE)
+        self.assertEqual(g.switch(1, b=3), 4)
+        self.assertEqual(g.switch(21), 42)
+        self.assertTrue(g.dead)
+
+        def raiser():
+            raise KeyError('from a dedicated stack')
+
+        with self.assertRaises(KeyError):
+            RawGreenlet(raiser, stack_size=STACK_SIZE).switch()
+
+        g = RawGreenlet(lambda: greenlet.getcurrent().parent.switch(),
+                        stack_size=STACK_SIZE)
+        g.switch()
+        with self.assertRaises(ValueError):
+            g.throw(ValueError)
+        self.assertTrue(g.dead)
+
+    def test_children_share_the_stack(self):
+        main = greenlet.getcurrent()
+
+        def child(depth):
+            value = _recurse_then_switch(depth, greenlet.getcurrent().parent, 'child')
+            return value * 2
+
+        def parent():
+            c1 = RawGreenlet(child)
+            c2 = RawGreenlet(child)
+            self.assertEqual(c1.switch(10), 'child')
+            self.assertEqual(c2.switch(20), 'child')
+            # The children are on our stack, and we're on theirs.
+            main.switch('parent')
+            self.assertEqual(c1.switch(1), 2)
+            self.assertEqual(c2.switch(2), 4)
+            return 'done'
+
+        p = RawGreenlet(parent, stack_size=STACK_SIZE)
+        self.assertEqual(p.switch(), 'parent')
+        self.assertEqual(p.switch(), 'done')
+
+    def test_child_outlives_parent(self):
+        main = greenlet.getcurrent()
+        children = []
+
+        def child():
+            main.switch('suspended')
+            return 'child done'
+
+        def parent():
+            c = RawGreenlet(child, parent=main)
+            children.append(c)
+            c.switch()
+            return 'parent done'
+
+        p = RawGreenlet(parent, stack_size=STACK_SIZE)
+        self.assertEqual(p.switch(), 'suspended')
+        # Main is the parent's parent
+        self.assertEqual(p.switch(), 'parent done')
+        del p
+        gc.collect()
+        self.assertEqual(children[0].switch(), 'child done')
+
+    def test_start_dedicated_from_dedicated(self):
+        def inner():
+            return _recurse_then_switch(5, greenlet.getcurrent().parent, 'inner') + 1
+
+        def outer():
+            g = RawGreenlet(inner, stack_size=STACK_SIZE)
+            first = g.switch()
+            return first, g.switch(1)
+
+        self.assertEqual(
+            RawGreenlet(outer, stack_size=STACK_SIZE).switch(),
+            ('inner', 2))
+
+    def test_unfinished_greenlets_are_killed(self):
+        main = greenlet.getcurrent()
+        killed = []
+
+        def func():
+            try:
+                main.switch()
+            except greenlet.GreenletExit:
+                killed.append(True)
+                raise
+
+        for _ in range(10):
+            g = RawGreenlet(func, stack_size=STACK_SIZE)
+            g.switch()
+            del g
+        gc.collect()
+        self.assertEqual(len(killed), 10)
+
+    def test_frames(self):
+        def func():
+            greenlet.getcurrent().parent.switch()
+
+        g = RawGreenlet(func, stack_size=STACK_SIZE)
+        g.switch()
+        self.assertEqual(g.gr_frame.f_code.co_name, 'func')
+        g.switch()
+        self.assertIsNone(g.gr_frame)
+
+    def test_tracing(self):
+        events = []
+
+        def trace(event, args):
+            events.append(event)
+
+        def func():
+            greenlet.getcurrent().parent.switch()
+
+        old = greenlet.settrace(trace)
+        try:
+            g = RawGreenlet(func, stack_size=STACK_SIZE)
+            g.switch()
+            g.switch()
+        finally:
+            greenlet.settrace(old)
+        self.assertEqual(events, ['switch'] * 4)
+        events = []
+
+        # sys.settrace inside the greenlet must be unwound
+        # correctly when it finishes.
+        def traced():
+            sys.settrace(lambda *args: None)
+            greenlet.getcurrent().parent.switch()
+            sys.settrace(None)
+        g = RawGreenlet(traced, stack_size=STACK_SIZE)
+        g.switch()
+        g.switch()
+        self.assertTrue(g.dead)
+        self.assertIsNone(sys.gettrace())
+
+    # Greenlets left suspended in a thread that exits can't be
+    # killed, so the objects their frames refer to stay alive.
+    @ignores_leakcheck
+    def test_in_thread(self):
+        results = []
+        suspended = []
+
+        def func():
+            greenlet.getcurrent().parent.switch()
+            results.append('never')
+
+        def target():
+            g = RawGreenlet(lambda: _recurse_then_switch(10, greenlet.getcurrent().parent, 42),
+                            stack_size=STACK_SIZE)
+            results.append(g.switch())
+            # Leave one suspended when the thread dies.
+            s = RawGreenlet(func, stack_size=STACK_SIZE)
+            s.switch()
+            suspended.append(s)
+
+        t = threading.Thread(target=target)
+        t.start()
+        t.join(10)
+        self.assertEqual(results, [42])
+        del suspended[:]
+        self.wait_for_pending_cleanups()
+        self.assertEqual(results, [42])
+
+
+@unittest.skipUnless(greenlet.GREENLET_USE_DEDICATED_STACKS,
+                     "Dedicated stacks not supported")
+class TestDedicatedStackPool(TestCase):
+
+    def setUp(self):
+        super().setUp()
+        greenlet.trim_dedicated_stack_pool()
+        self.orig_limit = greenlet.set_dedicated_stack_pool_limit(16 << 20)
+        self.orig_resident_limit = greenlet.set_dedicated_stack_pool_resident_limit(4 << 20)
+
+    def tearDown(self):
+        greenlet.set_dedicated_stack_pool_limit(self.orig_limit)
+        greenlet.set_dedicated_stack_pool_resident_limit(self.orig_resident_limit)
+        greenlet.trim_dedicated_stack_pool()
+        super().tearDown()
+
+    def _run_one(self):
+        g = RawGreenlet(lambda: _recurse_then_switch(20, greenlet.getcurrent().parent, 1),
+                        stack_size=STACK_SIZE)
+        g.switch()
+        g.switch()
+        self.assertTrue(g.dead)
+
+    def test_stacks_are_reused(self):
+        before = greenlet.get_dedicated_stack_pool_stats()
+        for _ in range(10):
+            self._run_one()
+        stats = greenlet.get_dedicated_stack_pool_stats()
+        self.assertEqual(stats['misses'] - before['misses'], 1)
+        self.assertEqual(stats['hits'] - before['hits'], 9)
+        self.assertEqual(stats['in_use_stacks'], 0)
+        self.assertEqual(stats['in_use_bytes'], 0)
+        self.assertEqual(stats['pooled_stacks'], 1)
+        self.assertGreater(stats['pooled_bytes'], STACK_SIZE)
+
+        self.assertEqual(greenlet.trim_dedicated_stack_pool(), stats['pooled_bytes'])
+        stats = greenlet.get_dedicated_stack_pool_stats()
+        self.assertEqual(stats['pooled_stacks'], 0)
+        self.assertEqual(stats['pooled_bytes'], 0)
+
+    def test_in_use(self):
+        main = greenlet.getcurrent()
+        glets = [RawGreenlet(main.switch, stack_size=STACK_SIZE) for _ in range(3)]
+        for g in glets:
+            g.switch()
+        stats = greenlet.get_dedicated_stack_pool_stats()
+        self.assertEqual(stats['in_use_stacks'], 3)
+        self.assertGreater(stats['in_use_bytes'], 3 * STACK_SIZE)
+        # At least the pages we touched.
+        self.assertGreater(stats['resident_bytes'], 0)
+        self.assertLess(stats['resident_bytes'], stats['in_use_bytes'])
+
+        for g in glets:
+            g.switch()
+        stats = greenlet.get_dedicated_stack_pool_stats()
+        self.assertEqual(stats['in_use_stacks'], 0)
+        self.assertEqual(stats['pooled_stacks'], 3)
+
+    def test_sizes_are_kept_apart(self):
+        before = greenlet.get_dedicated_stack_pool_stats()
+        self._run_one()
+        g = RawGreenlet(lambda: None, stack_size=STACK_SIZE * 2)
+        g.switch()
+        stats = greenlet.get_dedicated_stack_pool_stats()
+        self.assertEqual(stats['pooled_stacks'], 2)
+        self.assertEqual(stats['hits'], before['hits'])
+
+    def test_limit(self):
+        greenlet.set_dedicated_stack_pool_limit(0)
+        before = greenlet.get_dedicated_stack_pool_stats()
+        self._run_one()
+        self._run_one()
+        stats = greenlet.get_dedicated_stack_pool_stats()
+        self.assertEqual(stats['pooled_stacks'], 0)
+        self.assertEqual(stats['hits'], before['hits'])
+        self.assertEqual(stats['misses'] - before['misses'], 2)
+        self.assertEqual(stats['limit'], 0)
+
+    def test_resident_limit(self):
+        # Stacks whose memory has been released are still reused.
+        greenlet.set_dedicated_stack_pool_resident_limit(0)
+        before = greenlet.get_dedicated_stack_pool_stats()
+        for _ in range(3):
+            self._run_one()
+        stats = greenlet.get_dedicated_stack_pool_stats()
+        self.assertEqual(stats['resident_limit'], 0)
+        self.assertEqual(stats['pooled_stacks'], 1)
+        self.assertEqual(stats['hits'] - before['hits'], 2)
+
+    def test_largest_limits(self):
+        largest = sys.maxsize * 2 + 1
+        greenlet.set_dedicated_stack_pool_limit(largest)
+        greenlet.set_dedicated_stack_pool_resident_limit(largest)
+        stats = greenlet.get_dedicated_stack_pool_stats()
+        self.assertEqual(stats['limit'], largest)
+        self.assertEqual(stats['resident_limit'], largest)
+
+
+@unittest.skipIf(greenlet.GREENLET_USE_DEDICATED_STACKS,
+                 "Dedicated stacks are supported")
+class TestDedicatedStackUnsupported(TestCase):
+
+    def test_stack_size_refused(self):
+        with self.assertRaises(ValueError):
+            RawGreenlet(stack_size=STACK_SIZE)
+        self.assertIsNone(RawGreenlet(stack_size=None).stack_size)
+
+
+if __name__ == '__main__':
+    unittest.main()
@@ -110,6 +110,42 @@ class CAPITests(TestCase):
         self.assertEqual(str(exc.exception),
                          "exceptions must be classes, or instances, not str")
 
+    def test_trace_hook(self):
+        self.assertIsNone(_test_extension.test_get_trace_hook())
+        main = greenlet.getcurrent()
+        g = greenlet.greenlet(lambda: main.switch(42))
+        _test_extension.test_set_trace_hook(True)
+        try:
+            self.assertEqual(_test_extension.test_get_trace_hook(),
+                             (0, 0, 0, 0))
+            self.assertEqual(g.switch(), 42)
+            # Into g, and back out.
+            self.assertEqual(_test_extension.test_get_trace_hook(),
+                             (2, 0, id(g), id(main)))
+            with self.assertRaises(ValueError):
+                g.throw(ValueError)
+            # g was thrown into, and died raising it back to main.
+            self.assertEqual(_test_extension.test_get_trace_hook(),
+                             (2, 2, id(g), id(main)))
+        finally:
+            _test_extension.test_set_trace_hook(False)
+        self.assertIsNone(_test_extension.test_get_trace_hook())
+
+    def test_trace_hook_with_settrace(self):
+        events = []
+        main = greenlet.getcurrent()
+        g = greenlet.greenlet(lambda: main.switch())
+        _test_extension.test_set_trace_hook(True)
+        old_trace = greenlet.settrace(lambda *args: events.append(args))
+        try:
+            g.switch()
+        finally:
+            greenlet.settrace(old_trace)
+            counts = _test_extension.test_get_trace_hook()
+            _test_extension.test_set_trace_hook(False)
+        self.assertEqual(counts, (2, 0, id(g), id(main)))
+        self.assertEqual(events, [('switch', (main, g)), ('switch', (g, main))])
+
     @ignores_leakcheck
     def test_leaks(self):
         from . import PY314
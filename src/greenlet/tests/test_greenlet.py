@@ -396,6 +396,46 @@ class TestGreenlet(TestCase):
         self.assertEqual(((2,), {'x': 3}), g.switch())
         self.assertEqual((3, 9), g.switch())
 
+    def test_switch_single_argument(self):
+        # One argument is passed without packing it into a tuple;
+        # what arrives must be the same object, whatever it is.
+        def run(x):
+            while True:
+                x = greenlet.getcurrent().parent.switch(x)
+        g = RawGreenlet(run)
+        marker = object()
+        self.assertIs(g.switch(marker), marker)
+        for value in ((), (1,), (1, 2), [1], None, 'x'):
+            self.assertIs(g.switch(value), value)
+        self.assertEqual(g.switch(), ())
+        self.assertEqual(g.switch(1, 2), (1, 2))
+        self.assertEqual(g.switch(*[3]), 3)
+        g.throw()
+
+    def test_start_with_single_argument(self):
+        for value in (1, (1,), None):
+            self.assertEqual(RawGreenlet(lambda *args: args).switch(value), (value,))
+
+    def test_return_value_to_parent(self):
+        for value in (1, (1,), (), None):
+            self.assertIs(RawGreenlet(lambda value=value: value).switch(), value)
+        # Starting a parent with the return value of the child.
+        seen = []
+        parent = RawGreenlet(lambda *args: seen.append(args))
+        child = RawGreenlet(lambda: 42, parent)
+        child.switch()
+        self.assertEqual(seen, [(42,)])
+
+    def test_throw_arguments(self):
+        g = RawGreenlet(lambda: None)
+        with self.assertRaises(TypeError):
+            g.throw(ValueError, ValueError(), None, None)
+        g = RawGreenlet(greenlet.getcurrent().switch)
+        g.switch()
+        with self.assertRaises(ValueError):
+            g.throw(ValueError, 'msg', None)
+        self.assertTrue(g.dead)
+
     def test_switch_to_another_thread(self):
         data = {}
         created_event = threading.Event()
@@ -1027,6 +1067,112 @@ class TestGreenlet(TestCase):
         # The next line crashes on 3.12 if we haven't exposed the frames.
         self.assertIsNone(frame.f_back)
 
+    def test_frames_exposed_when_traceback_held(self):
+        # Like test_frames_always_exposed, but the reference to the
+        # frame is held by a traceback.
+        main = greenlet.getcurrent()
+
+        def outer():
+            inner()
+
+        def inner():
+            try:
+                raise ValueError
+            except ValueError as e:
+                main.switch(e)
+
+        gr = RawGreenlet(outer)
+        ex = gr.switch()
+
+        unrelated = RawGreenlet(lambda: None)
+        unrelated.switch()
+
+        frame = ex.__traceback__.tb_frame
+        self.assertEqual(frame.f_code.co_name, "inner")
+        self.assertEqual(frame.f_back.f_code.co_name, "outer")
+        self.assertIsNone(frame.f_back.f_back)
+        del ex, frame
+        gr.throw()
+
+    def test_frames_exposed_when_in_generator(self):
+        # A running generator's frame can be reached from the
+        # generator.
+        main = greenlet.getcurrent()
+
+        def gen():
+            main.switch()
+            yield
+
+        g = gen()
+
+        def outer():
+            next(g)
+
+        gr = RawGreenlet(outer)
+        gr.switch()
+
+        unrelated = RawGreenlet(lambda: None)
+        unrelated.switch()
+
+        frame = g.gi_frame
+        self.assertEqual(frame.f_code.co_name, "gen")
+        self.assertEqual(frame.f_back.f_code.co_name, "outer")
+        self.assertIsNone(frame.f_back.f_back)
+        del frame
+        gr.switch()
+        self.assertTrue(gr.dead)
+
+    def test_frames_exposed_when_gr_frame_read(self):
+        self.assertFalse(RawGreenlet().gr_frames_always_exposed)
+        main = greenlet.getcurrent()
+
+        def outer():
+            inner()
+            inner()
+
+        def inner():
+            main.switch()
+
+        gr = RawGreenlet(outer)
+        gr.switch()
+
+        unrelated = RawGreenlet(lambda: None)
+        unrelated.switch()
+
+        # Reading gr_frame exposes them now; reading it again doesn't
+        # do it twice.
+        frame = gr.gr_frame
+        self.assertIs(gr.gr_frame, frame)
+        self.assertEqual(frame.f_code.co_name, "inner")
+        self.assertEqual(frame.f_back.f_code.co_name, "outer")
+        self.assertIsNone(frame.f_back.f_back)
+        # Resuming puts them back, and switching away without anybody
+        # looking doesn't expose them.
+        gr.switch()
+        gr.switch()
+        self.assertTrue(gr.dead)
+        self.assertIsNone(gr.gr_frame)
+
+    def test_frames_exposed_later_nested_c_calls(self):
+        from functools import partial
+        from . import _test_extension_cpp
+
+        def recurse(v):
+            if v > 0:
+                return v * _test_extension_cpp.test_call(partial(recurse, v - 1))
+            parent = greenlet.getcurrent().parent
+            return parent.switch() + parent.switch()
+
+        gr = RawGreenlet(recurse)
+        gr.switch(5)
+        gr.switch(1)
+        frame = gr.gr_frame
+        for i in range(5):
+            self.assertEqual(frame.f_locals["v"], i)
+            frame = frame.f_back
+        self.assertIsNone(frame.f_back)
+        self.assertEqual(gr.switch(9), 1200)  # 1200 = 5! * (1 + 9)
+
     def test_switching_holding_critical_section_no_crash(self):
         # https://github.com/python-greenlet/greenlet/issues/513
         # In no-GIL builds, we were failing to restore the
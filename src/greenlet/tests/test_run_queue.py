@@ -0,0 +1,125 @@
+"""
+Tests for greenlet.RunQueue.
+"""
+import threading
+
+import greenlet
+from . import TestCase
+
+
+class TestRunQueue(TestCase):
+
+    def test_spawn_and_run(self):
+        queue = greenlet.RunQueue()
+        results = []
+        g = queue.spawn(lambda *args, **kwargs: results.append((args, kwargs)), 1, 2, x=3)
+        self.assertIsInstance(g, greenlet.greenlet)
+        self.assertIs(g.parent, greenlet.getcurrent())
+        self.assertEqual(len(queue), 1)
+        self.assertEqual(queue.run_until_empty(), 1)
+        self.assertEqual(len(queue), 0)
+        self.assertTrue(g.dead)
+        self.assertEqual(results, [((1, 2), {'x': 3})])
+
+    def test_round_robin(self):
+        queue = greenlet.RunQueue()
+        hub = greenlet.getcurrent()
+        log = []
+
+        def worker(name, count):
+            me = greenlet.getcurrent()
+            for i in range(count):
+                log.append((name, i))
+                queue.schedule(me, i)
+                self.assertEqual(hub.switch(), i)
+            log.append((name, 'done'))
+
+        queue.spawn(worker, 'a', 2)
+        queue.spawn(worker, 'b', 3)
+        self.assertEqual(queue.run_until_empty(), 7)
+        self.assertEqual(log, [
+            ('a', 0), ('b', 0),
+            ('a', 1), ('b', 1),
+            ('a', 'done'), ('b', 2),
+            ('b', 'done'),
+        ])
+
+    def test_schedule_switch_semantics(self):
+        queue = greenlet.RunQueue()
+        hub = greenlet.getcurrent()
+        received = []
+
+        def worker():
+            while True:
+                received.append(hub.switch())
+
+        g = greenlet.greenlet(worker)
+        g.switch()
+        queue.schedule(g)
+        queue.schedule(g, 1)
+        queue.schedule(g, 1, 2)
+        queue.schedule(g, k=1)
+        self.assertEqual(queue.run_until_empty(), 4)
+        # The same as switch() itself.
+        self.assertEqual(received, [(), 1, (1, 2), {'k': 1}])
+        g.throw(greenlet.GreenletExit)
+
+    def test_exception_propagates_and_keeps_rest(self):
+        queue = greenlet.RunQueue()
+
+        def boom():
+            raise ValueError('boom')
+
+        ran = []
+        queue.spawn(boom)
+        queue.spawn(ran.append, 1)
+        with self.assertRaises(ValueError):
+            queue.run_until_empty()
+        self.assertEqual(len(queue), 1)
+        self.assertEqual(queue.run_until_empty(), 1)
+        self.assertEqual(ran, [1])
+
+    def test_clear(self):
+        queue = greenlet.RunQueue()
+        queue.spawn(self.fail)
+        queue.clear()
+        self.assertEqual(len(queue), 0)
+        self.assertEqual(queue.run_until_empty(), 0)
+
+    def test_bad_arguments(self):
+        queue = greenlet.RunQueue()
+        with self.assertRaises(TypeError):
+            greenlet.RunQueue(1)
+        with self.assertRaises(TypeError):
+            queue.spawn()
+        with self.assertRaises(TypeError):
+            queue.schedule(lambda: None)
+        with self.assertRaises(TypeError):
+            queue.schedule()
+        self.assertEqual(len(queue), 0)
+
+    def test_other_thread(self):
+        queue = greenlet.RunQueue()
+        errors = []
+
+        def run():
+            try:
+                queue.spawn(lambda: None)
+            except greenlet.error as e:
+                errors.append(e)
+
+        t = threading.Thread(target=run)
+        t.start()
+        t.join(10)
+        self.assertEqual(len(errors), 1)
+        self.assertEqual(len(queue), 0)
+
+    def test_collects_cycles(self):
+        import gc
+        import weakref
+        queue = greenlet.RunQueue()
+        g = queue.spawn(lambda q: None, queue)
+        ref = weakref.ref(g)
+        del g, queue
+        gc.collect()
+        self.assertIsNone(ref())
@@ -1,3 +1,5 @@
+import sys
+
 import greenlet
 from . import TestCase
 
@@ -17,3 +19,271 @@ class Test(TestCase):
         self.assertGreater(g._stack_saved, 0)
         g.switch()
         self.assertEqual(g._stack_saved, 0)
+
+
+class TestStackCopyPool(TestCase):
+
+    def setUp(self):
+        super().setUp()
+        self.orig_limit = greenlet.set_stack_copy_pool_limit(1 << 20)
+        self.orig_retention_limit = greenlet.set_stack_copy_retention_limit(0)
+
+    def tearDown(self):
+        greenlet.set_stack_copy_pool_limit(self.orig_limit)
+        greenlet.set_stack_copy_retention_limit(self.orig_retention_limit)
+        super().tearDown()
+
+    def _ping_pong(self, count):
+        main = greenlet.getcurrent()
+
+        def func():
+            while True:
+                main.switch()
+
+        g = greenlet.greenlet(func)
+        for _ in range(count):
+            g.switch()
+        return g
+
+    def test_steady_state_switching_does_not_allocate(self):
+        # Warm up the pool.
+        g = self._ping_pong(10)
+        before = greenlet.get_stack_copy_pool_stats()
+        for _ in range(1000):
+            g.switch()
+        after = greenlet.get_stack_copy_pool_stats()
+        self.assertEqual(after['misses'], before['misses'])
+        self.assertGreaterEqual(after['hits'], before['hits'] + 1000)
+        self.assertGreater(after['pooled_bytes'], 0)
+        self.assertLessEqual(after['pooled_bytes'], after['limit'])
+
+    def test_trim(self):
+        self._ping_pong(10)
+        stats = greenlet.get_stack_copy_pool_stats()
+        self.assertGreater(stats['pooled_buffers'], 0)
+        self.assertEqual(greenlet.trim_stack_copy_pool(), stats['pooled_bytes'])
+        stats = greenlet.get_stack_copy_pool_stats()
+        self.assertEqual(stats['pooled_bytes'], 0)
+        self.assertEqual(stats['pooled_buffers'], 0)
+        self.assertEqual(greenlet.trim_stack_copy_pool(), 0)
+
+    def test_limit_zero_disables_pooling(self):
+        self._ping_pong(10)
+        self.assertEqual(greenlet.set_stack_copy_pool_limit(0), 1 << 20)
+        self.assertEqual(greenlet.get_stack_copy_pool_stats()['pooled_bytes'], 0)
+        g = self._ping_pong(10)
+        before = greenlet.get_stack_copy_pool_stats()
+        g.switch()
+        after = greenlet.get_stack_copy_pool_stats()
+        self.assertEqual(after['pooled_bytes'], 0)
+        self.assertEqual(after['hits'], before['hits'])
+        self.assertGreater(after['misses'], before['misses'])
+
+    def test_bad_limit(self):
+        with self.assertRaises(TypeError):
+            greenlet.set_stack_copy_pool_limit('1')
+        with self.assertRaises(OverflowError):
+            greenlet.set_stack_copy_pool_limit(-1)
+
+    def test_largest_limits(self):
+        largest = sys.maxsize * 2 + 1
+        greenlet.set_stack_copy_pool_limit(largest)
+        greenlet.set_stack_copy_retention_limit(largest)
+        stats = greenlet.get_stack_copy_pool_stats()
+        self.assertEqual(stats['limit'], largest)
+        self.assertEqual(stats['retention_limit'], largest)
+
+    def test_retained_buffers_bypass_the_pool(self):
+        self.assertEqual(greenlet.set_stack_copy_retention_limit(1 << 20), 0)
+        self.assertEqual(greenlet.get_stack_copy_pool_stats()['retention_limit'], 1 << 20)
+        g = self._ping_pong(10)
+        before = greenlet.get_stack_copy_pool_stats()
+        for _ in range(1000):
+            g.switch()
+        after = greenlet.get_stack_copy_pool_stats()
+        self.assertEqual(after['misses'], before['misses'])
+        self.assertEqual(after['hits'], before['hits'])
+        # Restoring still works.
+        self.assertGreater(g._stack_saved, 0)
+        g.throw(greenlet.GreenletExit)
+        self.assertTrue(g.dead)
+        self.assertEqual(g._stack_saved, 0)
+
+    def test_retained_buffer_reused_after_restore(self):
+        greenlet.set_stack_copy_retention_limit(1 << 20)
+        main = greenlet.getcurrent()
+        results = []
+
+        def func(arg):
+            results.append(arg)
+            for i in range(5):
+                results.append(main.switch(i))
+            return 'done'
+
+        g = greenlet.greenlet(func)
+        self.assertEqual([g.switch(x) for x in 'abcde'], [0, 1, 2, 3, 4])
+        self.assertEqual(g.switch('f'), 'done')
+        self.assertEqual(results, list('abcdef'))
+
+
+def _nest_then(depth, func):
+    if depth:
+        # Calling through a builtin makes the interpreter recurse in
+        # C, so the main greenlet has a good deal of stack to save.
+        return next(map(_nest_then, (depth - 1,), (func,))) + depth
+    return func()
+
+
+class TestPackedStacks(TestCase):
+
+    def setUp(self):
+        super().setUp()
+        self.orig_limit = greenlet.set_stack_copy_packing_limit(0)
+        self.orig_idle = greenlet.set_stack_copy_packing_idle(-1)
+
+    def tearDown(self):
+        greenlet.set_stack_copy_packing_limit(self.orig_limit)
+        greenlet.set_stack_copy_packing_idle(self.orig_idle)
+        super().tearDown()
+
+    def test_settings(self):
+        self.assertEqual(greenlet.set_stack_copy_packing_limit(4096), 0)
+        self.assertEqual(greenlet.set_stack_copy_packing_idle(0.5), -1.0)
+        stats = greenlet.get_stack_copy_pool_stats()
+        self.assertEqual(stats['packing_limit'], 4096)
+        self.assertEqual(stats['packing_idle'], 0.5)
+        self.assertEqual(greenlet.set_stack_copy_packing_idle(-3), 0.5)
+        self.assertEqual(greenlet.get_stack_copy_pool_stats()['packing_idle'], -1.0)
+        with self.assertRaises(TypeError):
+            greenlet.set_stack_copy_packing_limit('1')
+        with self.assertRaises(OverflowError):
+            greenlet.set_stack_copy_packing_limit(-1)
+        with self.assertRaises(TypeError):
+            greenlet.set_stack_copy_packing_idle('1')
+        with self.assertRaises(ValueError):
+            greenlet.set_stack_copy_packing_idle(float('nan'))
+
+    def _check_packed_round_robin(self):
+        main = greenlet.getcurrent()
+
+        def func(depth):
+            def loop():
+                total = 0
+                while True:
+                    total += main.switch(total)
+            return _nest_then(depth, loop)
+
+        glets = [greenlet.greenlet(func) for _ in range(5)]
+        totals = [g.switch(depth * 20) for depth, g in enumerate(glets)]
+        self.assertEqual(totals, [0] * 5)
+        before = greenlet.get_stack_copy_pool_stats()
+        for i in range(1, 4):
+            totals = [g.switch(i) for g in glets]
+            self.assertEqual(totals, [i * (i + 1) // 2] * 5)
+        after = greenlet.get_stack_copy_pool_stats()
+        for g in glets:
+            self.assertGreater(g._stack_saved, 0)
+            g.throw(greenlet.GreenletExit)
+            self.assertEqual(g._stack_saved, 0)
+        return before, after
+
+    def test_packed_by_limit(self):
+        start = greenlet.get_stack_copy_pool_stats()
+        before, after = self._check_packed_round_robin()
+        self.assertGreaterEqual(after['packs'], before['packs'] + 15)
+        self.assertGreaterEqual(after['unpacks'], before['unpacks'] + 15)
+        self.assertGreater(after['unpack_ns'], before['unpack_ns'])
+        self.assertGreater(after['packed_stacks'], 0)
+        self.assertGreater(after['packed_saved_bytes'], after['packed_bytes'])
+        self.assertEqual(after['saved_bytes'], 0)
+        # Other greenlets left over from earlier tests may have been
+        # packed too, but ours are gone.
+        stats = greenlet.get_stack_copy_pool_stats()
+        self.assertEqual(stats['packed_stacks'] + stats['saved_stacks'],
+                         start['packed_stacks'] + start['saved_stacks'])
+
+    def test_packed_when_idle(self):
+        greenlet.set_stack_copy_packing_limit(1 << 62)
+        greenlet.set_stack_copy_packing_idle(0)
+        before, after = self._check_packed_round_robin()
+        self.assertGreaterEqual(after['packs'], before['packs'] + 15)
+
+    def test_not_packed_by_default(self):
+        greenlet.set_stack_copy_packing_limit(self.orig_limit)
+        before, after = self._check_packed_round_robin()
+        self.assertEqual(after['packs'], before['packs'])
+        self.assertEqual(after['packed_stacks'], 0)
+        self.assertGreater(after['saved_stacks'], 0)
+        self.assertGreater(after['saved_bytes'], 0)
+
+
+class TestSavedStackBudget(TestCase):
+
+    def setUp(self):
+        super().setUp()
+        self.orig_budget = greenlet.get_saved_stack_stats()['budget']
+
+    def tearDown(self):
+        greenlet.set_saved_stack_budget(self.orig_budget, None)
+        super().tearDown()
+
+    def _suspended(self, count):
+        main = greenlet.getcurrent()
+        glets = [greenlet.greenlet(main.switch) for _ in range(count)]
+        for g in glets:
+            g.switch()
+        return glets
+
+    def test_stats(self):
+        before = greenlet.get_saved_stack_stats()
+        glets = self._suspended(3)
+        after = greenlet.get_saved_stack_stats()
+        self.assertEqual(after['greenlets'], before['greenlets'] + 3)
+        self.assertGreaterEqual(after['bytes'] - before['bytes'],
+                                sum(g._stack_saved for g in glets))
+        for g in glets:
+            g.switch()
+        self.assertEqual(greenlet.get_saved_stack_stats(), before)
+
+    def test_callback_when_over_budget(self):
+        calls = []
+        stats = greenlet.get_saved_stack_stats()
+        current = stats['bytes']
+        self.assertEqual(greenlet.set_saved_stack_budget(current, calls.append),
+                         self.orig_budget)
+        glets = self._suspended(3)
+        # Called once on the way over, not again until back under.
+        self.assertEqual(len(calls), 1)
+        self.assertGreater(calls[0], current)
+        self.assertEqual(greenlet.get_saved_stack_stats()['budget_calls'],
+                         stats['budget_calls'] + 1)
+        for g in glets:
+            g.switch()
+        glets = self._suspended(1)
+        self.assertEqual(len(calls), 2)
+        glets[0].switch()
+
+    def test_callback_errors_are_unraisable(self):
+        def callback(nbytes):
+            raise ValueError(nbytes)
+
+        unraisable = []
+        old_hook = sys.unraisablehook
+        sys.unraisablehook = unraisable.append
+        try:
+            greenlet.set_saved_stack_budget(0, callback)
+            g = self._suspended(1)[0]
+            greenlet.set_saved_stack_budget(self.orig_budget, None)
+            g.switch()
+        finally:
+            sys.unraisablehook = old_hook
+        self.assertEqual(len(unraisable), 1)
+        self.assertIsInstance(unraisable[0].exc_value, ValueError)
+        self.assertIs(unraisable[0].object, callback)
+
+    def test_bad_arguments(self):
+        with self.assertRaises(TypeError):
+            greenlet.set_saved_stack_budget(0, 42)
+        with self.assertRaises(OverflowError):
+            greenlet.set_saved_stack_budget(-1, None)
+        self.assertEqual(greenlet.get_saved_stack_stats()['budget'], self.orig_budget)
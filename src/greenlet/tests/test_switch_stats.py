@@ -0,0 +1,287 @@
+import tempfile
+import threading
+import time
+
+import greenlet
+from . import TestCase
+
+
+def _ping_pong(count):
+    # Switch to a new greenlet and back *count* times; return it,
+    # still suspended.
+    main = greenlet.getcurrent()
+
+    def func():
+        while True:
+            main.switch()
+
+    g = greenlet.greenlet(func)
+    for _ in range(count):
+        g.switch()
+    return g
+
+
+class TestSwitchStats(TestCase):
+
+    def tearDown(self):
+        greenlet.enable_switch_stats(False)
+        super().tearDown()
+
+    def test_disabled_by_default(self):
+        self.assertIsNone(greenlet.get_switch_stats())
+        _ping_pong(10)
+        self.assertIsNone(greenlet.get_switch_stats())
+
+    def test_stats(self):
+        greenlet.enable_switch_stats(True)
+        stats = greenlet.get_switch_stats()
+        self.assertEqual(stats['switches'], 0)
+        self.assertEqual(stats['switch_ns'], 0)
+        self.assertEqual(stats['histogram'], [])
+
+        g = _ping_pong(10)
+        stats = greenlet.get_switch_stats()
+        # Ten times there and back.
+        self.assertEqual(stats['switches'], 20)
+        self.assertEqual(sum(stats['histogram']), 20)
+        self.assertGreater(stats['histogram'][-1], 0)
+        self.assertGreaterEqual(stats['switch_ns'], stats['max_ns'])
+        self.assertLess(stats['max_ns'], 2 ** len(stats['histogram']))
+        self.assertGreaterEqual(stats['max_ns'], 2 ** (len(stats['histogram']) - 2))
+        self.assertGreater(stats['copied_to_heap'], 0)
+        self.assertGreater(stats['copied_to_stack'], 0)
+
+        # Killing it takes two more.
+        del g
+        self.assertEqual(greenlet.get_switch_stats()['switches'], 22)
+
+    def test_enabling_again_resets(self):
+        greenlet.enable_switch_stats(True)
+        g = _ping_pong(5)
+        self.assertEqual(greenlet.get_switch_stats()['switches'], 10)
+        greenlet.enable_switch_stats(True)
+        stats = greenlet.get_switch_stats()
+        self.assertEqual(stats['switches'], 0)
+        self.assertEqual(stats['copied_to_heap'], 0)
+        self.assertEqual(stats['copied_to_stack'], 0)
+        del g
+
+        greenlet.enable_switch_stats(False)
+        self.assertIsNone(greenlet.get_switch_stats())
+
+    def test_per_thread(self):
+        greenlet.enable_switch_stats(True)
+        results = []
+
+        def other_thread():
+            results.append(greenlet.get_switch_stats())
+            _ping_pong(5)
+
+        t = threading.Thread(target=other_thread)
+        t.start()
+        t.join(10)
+        self.assertEqual(results, [None])
+        self.assertEqual(greenlet.get_switch_stats()['switches'], 0)
+
+
+class TestSwitchHistory(TestCase):
+
+    def tearDown(self):
+        greenlet.enable_switch_history(0)
+        super().tearDown()
+
+    def _dump(self, dump):
+        with tempfile.TemporaryFile() as f:
+            result = dump(f.fileno())
+            f.seek(0)
+            return result, f.read().decode('ascii').splitlines()
+
+    def test_disabled_by_default(self):
+        self.assertIsNone(greenlet.get_switch_history())
+        self.assertEqual(self._dump(greenlet.dump_switch_history), (False, []))
+
+    def test_history(self):
+        main = greenlet.getcurrent()
+        greenlet.enable_switch_history(4)
+        self.assertEqual(greenlet.get_switch_history(), [])
+
+        g = _ping_pong(3)
+        history = greenlet.get_switch_history()
+        # The last four of the six.
+        self.assertEqual(
+            [(origin, target, event) for _, origin, target, event, _ in history],
+            [(id(main), id(g), 'switch'), (id(g), id(main), 'switch')] * 2)
+        timestamps = [entry[0] for entry in history]
+        self.assertEqual(timestamps, sorted(timestamps))
+        # When g switches back to main, it's the one that's saved.
+        self.assertGreater(history[1][4], 0)
+
+        with self.assertRaises(ValueError):
+            g.throw(ValueError)
+        self.assertEqual(
+            [entry[1:4] for entry in greenlet.get_switch_history()[-2:]],
+            [(id(main), id(g), 'throw'), (id(g), id(main), 'throw')])
+
+    def test_dump(self):
+        greenlet.enable_switch_history(100)
+        g = _ping_pong(2)
+        result, lines = self._dump(greenlet.dump_switch_history)
+        self.assertTrue(result)
+        self.assertEqual(len(lines), 5)
+        self.assertIn('(4 of 4)', lines[0])
+        self.assertIn('switch 0x%x -> 0x%x' % (id(g), id(greenlet.getcurrent())),
+                      lines[-1])
+        del g
+
+    def test_dump_from_c(self):
+        from . import _test_extension
+        self.assertEqual(self._dump(_test_extension.test_dump_switch_history),
+                         (-1, []))
+        greenlet.enable_switch_history(1)
+        g = _ping_pong(1)
+        result, lines = self._dump(_test_extension.test_dump_switch_history)
+        self.assertEqual(result, 0)
+        self.assertEqual(len(lines), 2)
+        self.assertIn('(1 of 2)', lines[0])
+        del g
+
+    def test_dump_from_c_other_thread(self):
+        from . import _test_extension
+        greenlet.enable_switch_history(1)
+        results = []
+
+        def other_thread():
+            # This thread's own history, not the main thread's.
+            results.append(self._dump(_test_extension.test_dump_switch_history))
+            greenlet.enable_switch_history(1)
+            _ping_pong(1)
+            results.append(self._dump(_test_extension.test_dump_switch_history)[0])
+            greenlet.enable_switch_history(0)
+            results.append(self._dump(_test_extension.test_dump_switch_history))
+
+        t = threading.Thread(target=other_thread)
+        t.start()
+        t.join(10)
+        self.assertEqual(results, [(-1, []), 0, (-1, [])])
+        self.assertEqual(self._dump(_test_extension.test_dump_switch_history)[0], 0)
+
+    def test_enabling_again_resets(self):
+        greenlet.enable_switch_history(10)
+        g = _ping_pong(2)
+        self.assertEqual(len(greenlet.get_switch_history()), 4)
+        greenlet.enable_switch_history(10)
+        self.assertEqual(greenlet.get_switch_history(), [])
+        del g
+        greenlet.enable_switch_history(0)
+        self.assertIsNone(greenlet.get_switch_history())
+
+    def test_bad_size(self):
+        with self.assertRaises(OverflowError):
+            greenlet.enable_switch_history(-1)
+        with self.assertRaises(TypeError):
+            greenlet.enable_switch_history('10')
+        self.assertIsNone(greenlet.get_switch_history())
+
+
+class TestGreenletAccounting(TestCase):
+
+    def tearDown(self):
+        greenlet.enable_greenlet_accounting(False)
+        super().tearDown()
+
+    def test_disabled_by_default(self):
+        self.assertIsNone(greenlet.get_greenlet_accounting())
+        main = greenlet.getcurrent()
+        g = greenlet.greenlet(main.switch)
+        g.switch()
+        self.assertEqual(g.gr_cpu_time, 0)
+        self.assertEqual(g.gr_switch_count, 0)
+        self.assertIsNone(g.gr_last_resumed)
+        del g
+
+    def test_accounting(self):
+        main = greenlet.getcurrent()
+
+        def busy():
+            while True:
+                deadline = time.monotonic() + 0.01
+                while time.monotonic() < deadline:
+                    pass
+                main.switch()
+
+        def idle():
+            while True:
+                main.switch()
+
+        busy_glet = greenlet.greenlet(busy)
+        idle_glet = greenlet.greenlet(idle)
+        # The main greenlet keeps its count from before.
+        main_count = main.gr_switch_count
+        greenlet.enable_greenlet_accounting(True)
+        self.assertEqual(greenlet.get_greenlet_accounting()['switches'], 0)
+        for _ in range(3):
+            busy_glet.switch()
+            idle_glet.switch()
+
+        self.assertEqual(busy_glet.gr_switch_count, 3)
+        self.assertEqual(idle_glet.gr_switch_count, 3)
+        self.assertGreaterEqual(busy_glet.gr_cpu_time, 0.03)
+        self.assertLess(idle_glet.gr_cpu_time, busy_glet.gr_cpu_time)
+        self.assertLess(busy_glet.gr_last_resumed, idle_glet.gr_last_resumed)
+
+        self.assertEqual(main.gr_switch_count - main_count, 6)
+        totals = greenlet.get_greenlet_accounting()
+        self.assertEqual(totals['switches'], 12)
+        self.assertGreaterEqual(totals['cpu_time'], 0.03)
+
+        # While it runs, its time so far counts.
+        before = main.gr_cpu_time
+        deadline = time.monotonic() + 0.01
+        while time.monotonic() < deadline:
+            pass
+        self.assertGreaterEqual(main.gr_cpu_time - before, 0.01)
+
+        # Stopping keeps what was accumulated.
+        greenlet.enable_greenlet_accounting(False)
+        busy_glet.switch()
+        self.assertEqual(busy_glet.gr_switch_count, 3)
+        self.assertIsNone(greenlet.get_greenlet_accounting())
+        del busy_glet
+        del idle_glet
+
+    def test_per_thread(self):
+        greenlet.enable_greenlet_accounting(True)
+        results = []
+
+        def other_thread():
+            results.append(greenlet.get_greenlet_accounting())
+            main = greenlet.getcurrent()
+            g = greenlet.greenlet(main.switch)
+            g.switch()
+            results.append(g.gr_switch_count)
+
+        t = threading.Thread(target=other_thread)
+        t.start()
+        t.join(10)
+        self.assertEqual(results, [None, 0])
+
+    def test_read_from_other_thread(self):
+        main = greenlet.getcurrent()
+        greenlet.enable_greenlet_accounting(True)
+        results = []
+
+        def other_thread():
+            main_greenlets = greenlet._greenlet.get_total_main_greenlets()
+            before = main.gr_cpu_time
+            time.sleep(0.02)
+            # Main is still running in its own thread.
+            results.append(main.gr_cpu_time - before)
+            # Reading it didn't give this thread greenlet state.
+            results.append(greenlet._greenlet.get_total_main_greenlets() - main_greenlets)
+
+        t = threading.Thread(target=other_thread)
+        t.start()
+        t.join(10)
+        self.assertGreaterEqual(results[0], 0.02)
+        self.assertEqual(results[1], 0)
+        self.assertEqual(greenlet.get_greenlet_accounting()['switches'], 0)
@@ -25,9 +25,10 @@ class SomeError(Exception):
 class GreenletTracer(object):
     oldtrace = None
 
-    def __init__(self, error_on_trace=False):
+    def __init__(self, error_on_trace=False, **settrace_kwargs):
         self.actions = []
         self.error_on_trace = error_on_trace
+        self.settrace_kwargs = settrace_kwargs
 
     def __call__(self, *args):
         self.actions.append(args)
@@ -35,11 +36,12 @@ class GreenletTracer(object):
             raise SomeError
 
     def __enter__(self):
-        self.oldtrace = greenlet.settrace(self)
+        self.oldtrace = greenlet.gettrace_config()
+        greenlet.settrace(self, **self.settrace_kwargs)
         return self.actions
 
     def __exit__(self, *args):
-        greenlet.settrace(self.oldtrace)
+        greenlet.settrace(**self.oldtrace)
 
 
 class TestGreenletTracing(TestCase):
@@ -90,6 +92,132 @@ class TestGreenletTracing(TestCase):
         with tracer:
             greenlet.settrace(tracer)
 
+    def test_start_and_finish(self):
+        main = greenlet.getcurrent()
+        def dummy():
+            pass
+        def dummyexc():
+            raise SomeError()
+
+        with GreenletTracer(events=('start', 'finish')) as actions:
+            g1 = greenlet.greenlet(dummy)
+            g1.switch()
+            g2 = greenlet.greenlet(dummyexc)
+            self.assertRaises(SomeError, g2.switch)
+
+        self.assertEqual(actions, [
+            ('start', (main, g1)),
+            ('finish', (g1, main)),
+            ('start', (main, g2)),
+            ('finish', (g2, main)),
+        ])
+
+    def test_all_events(self):
+        main = greenlet.getcurrent()
+        g = greenlet.greenlet(lambda: None)
+        with GreenletTracer(events=['switch', 'throw', 'start', 'finish']) as actions:
+            g.switch()
+
+        self.assertEqual(actions, [
+            ('switch', (main, g)),
+            ('start', (main, g)),
+            ('finish', (g, main)),
+            ('switch', (g, main)),
+        ])
+
+    def test_exception_from_finish(self):
+        g = greenlet.greenlet(lambda: 42)
+        with GreenletTracer(error_on_trace=True, events=('finish',)):
+            self.assertRaises(SomeError, g.switch)
+            self.assertIsNone(greenlet.gettrace())
+        self.assertTrue(g.dead)
+
+    def test_sample_every_nth(self):
+        main = greenlet.getcurrent()
+        def loop():
+            while True:
+                main.switch()
+        g = greenlet.greenlet(loop)
+        g.switch()
+        with GreenletTracer(sample=3) as actions:
+            for _ in range(9):
+                g.switch()
+
+        # The third, sixth, ... of 18.
+        self.assertEqual(actions, [
+            ('switch', (main, g)),
+            ('switch', (g, main)),
+            ('switch', (main, g)),
+            ('switch', (g, main)),
+            ('switch', (main, g)),
+            ('switch', (g, main)),
+        ])
+
+    def test_sample_randomly(self):
+        main = greenlet.getcurrent()
+        def loop():
+            while True:
+                main.switch()
+        g = greenlet.greenlet(loop)
+        g.switch()
+        with GreenletTracer(sample=4, randomly=True) as actions:
+            for _ in range(500):
+                g.switch()
+
+        # About 250 of the 1000.
+        self.assertGreater(len(actions), 100)
+        self.assertLess(len(actions), 500)
+
+    def test_config_round_trip(self):
+        default = greenlet.gettrace_config()
+        self.assertEqual(default, {
+            'callback': None,
+            'events': ('switch', 'throw'),
+            'sample': 1,
+            'randomly': False,
+        })
+
+        def outer(*args):
+            pass
+
+        def inner(*args):
+            pass
+
+        greenlet.settrace(outer, events=('finish', 'start'), sample=5, randomly=True)
+        try:
+            saved = greenlet.gettrace_config()
+            self.assertEqual(saved, {
+                'callback': outer,
+                'events': ('start', 'finish'),
+                'sample': 5,
+                'randomly': True,
+            })
+            self.assertIs(greenlet.settrace(inner, events=(), sample=2), outer)
+            self.assertEqual(greenlet.gettrace_config()['events'], ())
+            # Passing back only the function loses the rest...
+            greenlet.settrace(greenlet.settrace(inner))
+            self.assertEqual(greenlet.gettrace_config()['sample'], 1)
+            # ...the whole configuration doesn't.
+            greenlet.settrace(**saved)
+            self.assertEqual(greenlet.gettrace_config(), saved)
+        finally:
+            greenlet.settrace(**default)
+        self.assertEqual(greenlet.gettrace_config(), default)
+
+    def test_bad_arguments(self):
+        for kwargs in (
+                {'events': ('switch', 'bogus')},
+                {'events': (1,)},
+                {'sample': 0},
+        ):
+            with self.subTest(**kwargs):
+                with self.assertRaises(ValueError):
+                    greenlet.settrace(lambda *args: None, **kwargs)
+                self.assertIsNone(greenlet.gettrace())
+        with self.assertRaises(TypeError):
+            greenlet.settrace(lambda *args: None, events=42)
+        self.assertIsNone(greenlet.gettrace())
+
 
 class PythonTracer(object):
     oldtrace = None